@@ -0,0 +1,66 @@
+#include <chrono>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "event/batching.h"
+
+// Throughput of a backend that costs a fixed overhead per call plus a little per item,
+// like a database round trip or a GPU upload, asked one request at a time against
+// through Batching. state.range(0) requests are kept in flight with async, the
+// batch_size counter is the mean batch Batching sent.
+
+namespace {
+    struct Lookup {
+        int id;
+    };
+
+    void spin_for(std::chrono::nanoseconds duration) {
+        auto end = std::chrono::steady_clock::now() + duration;
+        while (std::chrono::steady_clock::now() < end) {}
+    }
+
+    constexpr auto kPerCall = std::chrono::microseconds(20);
+    constexpr auto kPerItem = std::chrono::nanoseconds(200);
+
+    std::vector<int> backend(Span<const Lookup> lookups) {
+        spin_for(kPerCall + kPerItem * lookups.size());
+        std::vector<int> results;
+        results.reserve(lookups.size());
+        for (auto& lookup: lookups) {
+            results.push_back(lookup.id);
+        }
+        return results;
+    }
+}
+
+static void BM_OneAtATime(benchmark::State& state) {
+    int id = 0;
+    for (auto _: state) {
+        Lookup lookup{id++};
+        benchmark::DoNotOptimize(backend(Span<const Lookup>(&lookup, 1)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OneAtATime)->UseRealTime();
+
+static void BM_Batching(benchmark::State& state) {
+    auto handler = Batching{64, std::chrono::microseconds(100), [](int& ctx, Span<const Lookup> lookups){
+        return backend(lookups);
+    }};
+    std::size_t in_flight = static_cast<std::size_t>(state.range(0));
+    int ctx = 0;
+    int id = 0;
+    std::vector<Future<int>> futures;
+    for (auto _: state) {
+        for (std::size_t i = 0; i < in_flight; i++) {
+            futures.push_back(handler.async(ctx, Lookup{id++}));
+        }
+        for (auto& future: futures) {
+            benchmark::DoNotOptimize(future.get());
+        }
+        futures.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * in_flight);
+    state.counters["batch_size"] = handler.stats().mean_batch_size();
+}
+BENCHMARK(BM_Batching)->Arg(1)->Arg(16)->Arg(64)->Arg(256)->UseRealTime();
@@ -0,0 +1,75 @@
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "event/buffered.h"
+
+// Throughput of a Buffered worker with a per event handler against the same work done
+// by a batch handler. The handlers write into a mutex protected sink, the batch handler
+// takes the lock once per batch. state.range(0) is the number of producer threads.
+
+namespace {
+    constexpr int kEvents = 1 << 14;
+
+    struct Sink {
+        std::mutex mutex;
+        long long total = 0;
+    };
+
+    template<typename HandlerT>
+    void run(benchmark::State& state, HandlerT& handler) {
+        int producers = static_cast<int>(state.range(0));
+        int ctx = 0;
+        for (auto _: state) {
+            std::vector<std::thread> threads;
+            for (int p = 0; p < producers; p++) {
+                threads.emplace_back([&]{
+                    for (int i = 0; i < kEvents / producers; i++) {
+                        handler.post(ctx, i);
+                    }
+                });
+            }
+            for (auto& thread: threads) {
+                thread.join();
+            }
+            Completion<void> done;
+            handler.submit(ctx, 0, done);
+            done.get();
+        }
+        state.SetItemsProcessed(state.iterations() * kEvents);
+    }
+
+    void BM_PerEvent(benchmark::State& state) {
+        Sink sink;
+        auto handler = Buffered {
+            [&](int& ctx, int event){
+                std::lock_guard<std::mutex> lock(sink.mutex);
+                sink.total += event;
+            },
+            QueueLimits{kEvents, 0, Overflow::Block},
+        };
+        run(state, handler);
+        benchmark::DoNotOptimize(sink.total);
+    }
+
+    void BM_Batched(benchmark::State& state) {
+        Sink sink;
+        auto handler = Buffered {
+            [&](int& ctx, Span<const int> events){
+                long long sum = 0;
+                for (int event: events) {
+                    sum += event;
+                }
+                std::lock_guard<std::mutex> lock(sink.mutex);
+                sink.total += sum;
+            },
+            QueueLimits{kEvents, 0, Overflow::Block},
+        };
+        run(state, handler);
+        benchmark::DoNotOptimize(sink.total);
+    }
+}
+
+BENCHMARK(BM_PerEvent)->Arg(1)->Arg(4)->UseRealTime();
+BENCHMARK(BM_Batched)->Arg(1)->Arg(4)->UseRealTime();
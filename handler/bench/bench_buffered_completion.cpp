@@ -0,0 +1,91 @@
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "event/buffered.h"
+
+// Per event cost of getting work onto a Buffered worker and (optionally) a result back:
+// the std::future path, fire and forget post, and a reused Completion.
+
+namespace {
+    constexpr int kBatch = 256;
+
+    auto make_handler() {
+        return Buffered {
+            [](int& ctx, int event){return event + 1;},
+        };
+    }
+
+    void BM_Future(benchmark::State& state) {
+        int ctx = 0;
+        auto handler = make_handler();
+        std::vector<std::future<int>> futures;
+        futures.reserve(kBatch);
+        for (auto _: state) {
+            for (int i = 0; i < kBatch; i++) {
+                futures.push_back(handler(ctx, i));
+            }
+            for (auto& future: futures) {
+                benchmark::DoNotOptimize(future.get());
+            }
+            futures.clear();
+        }
+        state.SetItemsProcessed(state.iterations() * kBatch);
+    }
+
+    void BM_Completion(benchmark::State& state) {
+        int ctx = 0;
+        auto handler = make_handler();
+        auto completions = std::make_unique<Completion<int>[]>(kBatch);
+        for (auto _: state) {
+            for (int i = 0; i < kBatch; i++) {
+                handler.submit(ctx, i, completions[i]);
+            }
+            for (int i = 0; i < kBatch; i++) {
+                benchmark::DoNotOptimize(completions[i].get());
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * kBatch);
+    }
+
+    void BM_Post(benchmark::State& state) {
+        int ctx = 0;
+        auto handler = make_handler();
+        Completion<int> done;
+        for (auto _: state) {
+            for (int i = 0; i < kBatch - 1; i++) {
+                handler.post(ctx, i);
+            }
+            // one completion per batch so the batch is timed until the worker has run it
+            handler.submit(ctx, 0, done);
+            benchmark::DoNotOptimize(done.get());
+        }
+        state.SetItemsProcessed(state.iterations() * kBatch);
+    }
+
+    // Round trip latency of a single event.
+    void BM_FutureRoundTrip(benchmark::State& state) {
+        int ctx = 0;
+        auto handler = make_handler();
+        for (auto _: state) {
+            benchmark::DoNotOptimize(handler(ctx, 1).get());
+        }
+    }
+
+    void BM_CompletionRoundTrip(benchmark::State& state) {
+        int ctx = 0;
+        auto handler = make_handler();
+        Completion<int> completion;
+        for (auto _: state) {
+            handler.submit(ctx, 1, completion);
+            benchmark::DoNotOptimize(completion.get());
+        }
+    }
+}
+
+BENCHMARK(BM_Future)->UseRealTime();
+BENCHMARK(BM_Completion)->UseRealTime();
+BENCHMARK(BM_Post)->UseRealTime();
+BENCHMARK(BM_FutureRoundTrip)->UseRealTime();
+BENCHMARK(BM_CompletionRoundTrip)->UseRealTime();
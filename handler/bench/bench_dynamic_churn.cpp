@@ -0,0 +1,127 @@
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "event/dynamic.h"
+
+// Dispatch throughput of DynamicAny with 8 threads dispatching while another thread keeps
+// adding and removing handlers, against the same tables behind a mutex.
+// state.range(0) is 1 to churn registrations and 0 to leave them alone.
+
+namespace {
+    constexpr int kDispatchThreads = 8;
+    constexpr int kEventsPerThread = 1 << 14;
+    constexpr int kHandlers = 16;
+
+    struct Tick {
+        int value;
+    };
+
+    // The obvious alternative, one lock taken by every dispatch and every registration.
+    class MutexDynamic {
+    public:
+        using Id = std::uint64_t;
+
+        template<typename EventT, typename HandlerT>
+        Id add(HandlerT handler) {
+            std::lock_guard<std::mutex> lock(mutex);
+            Id id = next_id++;
+            tables[type_id_v<EventT>].push_back(Entry{id, [handler](int& ctx, const void* event) mutable {
+                handler(ctx, *static_cast<const EventT*>(event));
+            }});
+            return id;
+        }
+
+        void remove(Id id) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& [type, entries]: tables) {
+                for (auto it = entries.begin(); it != entries.end(); it++) {
+                    if (it->id == id) {
+                        entries.erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+
+        template<typename EventT>
+        void operator()(int& ctx, const EventT& event) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = tables.find(type_id_v<EventT>);
+            if (it == tables.end()) {
+                return;
+            }
+            for (auto& entry: it->second) {
+                entry.call(ctx, &event);
+            }
+        }
+
+    private:
+        struct Entry {
+            Id id;
+            std::function<void(int&, const void*)> call;
+        };
+
+        std::mutex mutex;
+        std::unordered_map<TypeId, std::vector<Entry>> tables;
+        Id next_id = 1;
+    };
+
+    template<typename DynamicT>
+    void run(benchmark::State& state) {
+        bool churn = state.range(0);
+        DynamicT handler;
+        std::atomic<long long> total{0};
+        for (int i = 0; i < kHandlers; i++) {
+            handler.template add<Tick>([](int& ctx, const Tick& tick){ctx += tick.value;});
+        }
+
+        for (auto _: state) {
+            std::atomic<bool> done{false};
+            std::thread churner;
+            if (churn) {
+                churner = std::thread([&]{
+                    while (!done.load(std::memory_order_relaxed)) {
+                        auto id = handler.template add<Tick>([](int& ctx, const Tick& tick){ctx -= tick.value;});
+                        handler.remove(id);
+                    }
+                });
+            }
+
+            std::vector<std::thread> dispatchers;
+            for (int t = 0; t < kDispatchThreads; t++) {
+                dispatchers.emplace_back([&]{
+                    int ctx = 0;
+                    for (int i = 0; i < kEventsPerThread; i++) {
+                        handler(ctx, Tick{1});
+                    }
+                    total += ctx;
+                });
+            }
+            for (auto& thread: dispatchers) {
+                thread.join();
+            }
+            done = true;
+            if (churner.joinable()) {
+                churner.join();
+            }
+        }
+        benchmark::DoNotOptimize(total.load());
+        state.SetItemsProcessed(state.iterations() * kDispatchThreads * kEventsPerThread);
+    }
+
+    void BM_Rcu(benchmark::State& state) {
+        run<DynamicAny<int>>(state);
+    }
+
+    void BM_Mutex(benchmark::State& state) {
+        run<MutexDynamic>(state);
+    }
+}
+
+BENCHMARK(BM_Rcu)->Arg(0)->Arg(1)->UseRealTime();
+BENCHMARK(BM_Mutex)->Arg(0)->Arg(1)->UseRealTime();
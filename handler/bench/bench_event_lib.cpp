@@ -0,0 +1,407 @@
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "event/broadcast.h"
+#include "event/buffered.h"
+#include "event/dynamic.h"
+#include "event/first.h"
+#include "event/memoized.h"
+#include "event/must_handle.h"
+#include "event/pipeline.h"
+#include "event/serial.h"
+#include "event/sharded.h"
+
+// Dispatch cost of the combinators, the numbers to hold the event library's overhead on
+// hot paths against and to diff for regressions:
+//
+//     bazel run -c opt //handler:bench_event_lib -- --benchmark_format=json --benchmark_out=event_lib.json
+//
+// Serial, First, MustHandle and Dynamic are timed per event dispatched on the calling
+// thread against a hand written call of the same handlers, Memoized per request that
+// hits the cache. Buffered is timed per event
+// posted from 1 to 4 producer threads until the worker has handled them all, and per
+// round trip to an idle worker with each WaitStrategy. Sharded
+// per event with handlers that do some work, against one Buffered doing the same, and
+// likewise Pipeline with three stages of work against one Buffered doing all three.
+// Broadcast is timed per event fanned out to 1 to 4 consumers, against a Buffered per
+// consumer in a Serial.
+
+namespace {
+    struct Tick {
+        int value;
+    };
+
+    // The event types the size benchmarks are run with.
+    struct Trivial {
+        static Tick make() {return Tick{1};}
+        static int size(const Tick& event) {return event.value;}
+    };
+
+    struct String {
+        // Past the small string buffer, so every copy allocates.
+        static std::string make() {return std::string(64, 'x');}
+        static int size(const std::string& event) {return static_cast<int>(event.size());}
+    };
+
+    struct MoveOnly {
+        static std::unique_ptr<int> make() {return std::make_unique<int>(1);}
+        static int size(const std::unique_ptr<int>& event) {return *event;}
+    };
+
+    template<typename KindT>
+    using event_t = decltype(KindT::make());
+
+    // A distinct type per handler, like the lambdas of a real handler tree.
+    template<std::size_t I>
+    struct Add {
+        void operator()(int& ctx, const Tick& event) const {benchmark::DoNotOptimize(ctx += event.value);}
+    };
+
+    template<std::size_t I>
+    struct Answer {
+        std::optional<int> operator()(int& ctx, const Tick& event) const {
+            benchmark::DoNotOptimize(ctx);
+            return std::nullopt;
+        }
+    };
+
+    template<std::size_t...Is>
+    auto make_serial(std::index_sequence<Is...>) {return Serial{Add<Is>{}...};}
+
+    // Handlers - 1 optional answers that pass, then one definitive answer.
+    template<std::size_t...Is>
+    auto make_first(std::index_sequence<Is...>) {
+        return First{Answer<Is>{}..., [](int& ctx, const Tick& event){return event.value;}};
+    }
+
+    template<std::size_t Depth>
+    auto make_nested() {
+        if constexpr (Depth == 0) {
+            return Add<0>{};
+        } else {
+            return Serial{make_nested<Depth - 1>()};
+        }
+    }
+
+    // The last handler takes the event by value, so a movable event is moved into it.
+    template<typename KindT>
+    auto make_sized_serial() {
+        using EventT = event_t<KindT>;
+        return Serial {
+            [](int& ctx, const EventT& event){benchmark::DoNotOptimize(ctx += KindT::size(event));},
+            [](int& ctx, const EventT& event){benchmark::DoNotOptimize(ctx += KindT::size(event));},
+            [](int& ctx, const EventT& event){benchmark::DoNotOptimize(ctx += KindT::size(event));},
+            [](int& ctx, EventT event){benchmark::DoNotOptimize(ctx += KindT::size(event));},
+        };
+    }
+
+    template<std::size_t...Is>
+    void call_all(int& ctx, const Tick& event, std::index_sequence<Is...>) {
+        (Add<Is>{}(ctx, event), ...);
+    }
+}
+
+template<std::size_t Handlers>
+static void BM_Direct(benchmark::State& state) {
+    int ctx = 0;
+    for (auto _: state) {
+        call_all(ctx, Tick{1}, std::make_index_sequence<Handlers>{});
+    }
+}
+BENCHMARK_TEMPLATE(BM_Direct, 1);
+BENCHMARK_TEMPLATE(BM_Direct, 4);
+BENCHMARK_TEMPLATE(BM_Direct, 16);
+BENCHMARK_TEMPLATE(BM_Direct, 64);
+
+template<std::size_t Handlers>
+static void BM_Serial(benchmark::State& state) {
+    auto handler = make_serial(std::make_index_sequence<Handlers>{});
+    int ctx = 0;
+    for (auto _: state) {
+        handler(ctx, Tick{1});
+    }
+}
+BENCHMARK_TEMPLATE(BM_Serial, 1);
+BENCHMARK_TEMPLATE(BM_Serial, 4);
+BENCHMARK_TEMPLATE(BM_Serial, 16);
+BENCHMARK_TEMPLATE(BM_Serial, 64);
+
+template<std::size_t Depth>
+static void BM_SerialNested(benchmark::State& state) {
+    auto handler = make_nested<Depth>();
+    int ctx = 0;
+    for (auto _: state) {
+        handler(ctx, Tick{1});
+    }
+}
+BENCHMARK_TEMPLATE(BM_SerialNested, 1);
+BENCHMARK_TEMPLATE(BM_SerialNested, 4);
+BENCHMARK_TEMPLATE(BM_SerialNested, 16);
+
+template<std::size_t Handlers>
+static void BM_First(benchmark::State& state) {
+    auto handler = make_first(std::make_index_sequence<Handlers - 1>{});
+    int ctx = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(handler(ctx, Tick{1}));
+    }
+}
+BENCHMARK_TEMPLATE(BM_First, 1);
+BENCHMARK_TEMPLATE(BM_First, 4);
+BENCHMARK_TEMPLATE(BM_First, 16);
+
+template<std::size_t Handlers>
+static void BM_MustHandle(benchmark::State& state) {
+    auto handler = MustHandle{make_serial(std::make_index_sequence<Handlers>{})};
+    int ctx = 0;
+    for (auto _: state) {
+        handler(ctx, Tick{1});
+    }
+}
+BENCHMARK_TEMPLATE(BM_MustHandle, 1);
+BENCHMARK_TEMPLATE(BM_MustHandle, 16);
+
+// Dynamic holds one handler type, std::function being the usual choice.
+static void BM_Dynamic(benchmark::State& state) {
+    std::vector<std::function<void(int&, const Tick&)>> handlers;
+    for (int i = 0; i < state.range(0); i++) {
+        handlers.push_back(Add<0>{});
+    }
+    Dynamic handler(std::move(handlers));
+    int ctx = 0;
+    for (auto _: state) {
+        handler(ctx, Tick{1});
+    }
+}
+BENCHMARK(BM_Dynamic)->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+// state.range(0) distinct requests asked in turn, all of them cached after the first round.
+static void BM_Memoized(benchmark::State& state) {
+    auto handler = First{Memoized{[](int& ctx, int request){return request * 2;}, 1024}};
+    int ctx = 0;
+    int request = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(handler(ctx, request));
+        request = request + 1 == state.range(0) ? 0 : request + 1;
+    }
+}
+BENCHMARK(BM_Memoized)->Arg(1)->Arg(64)->Arg(1024);
+
+// Includes making the event, BM_MakeEvent is that alone.
+template<typename KindT>
+static void BM_MakeEvent(benchmark::State& state) {
+    for (auto _: state) {
+        auto event = KindT::make();
+        benchmark::DoNotOptimize(event);
+    }
+}
+BENCHMARK_TEMPLATE(BM_MakeEvent, Trivial);
+BENCHMARK_TEMPLATE(BM_MakeEvent, String);
+BENCHMARK_TEMPLATE(BM_MakeEvent, MoveOnly);
+
+template<typename KindT>
+static void BM_SerialEventSize(benchmark::State& state) {
+    auto handler = make_sized_serial<KindT>();
+    int ctx = 0;
+    for (auto _: state) {
+        handler(ctx, KindT::make());
+    }
+}
+BENCHMARK_TEMPLATE(BM_SerialEventSize, Trivial);
+BENCHMARK_TEMPLATE(BM_SerialEventSize, String);
+BENCHMARK_TEMPLATE(BM_SerialEventSize, MoveOnly);
+
+// state.range(0) producer threads post kEvents between them, then wait for the worker.
+template<typename KindT>
+static void BM_Buffered(benchmark::State& state) {
+    constexpr int kEvents = 1 << 14;
+    using EventT = event_t<KindT>;
+    auto handler = Buffered {
+        [](int& ctx, EventT event){benchmark::DoNotOptimize(ctx += KindT::size(event));},
+        QueueLimits{kEvents, 0, Overflow::Block},
+    };
+    int producers = static_cast<int>(state.range(0));
+    int ctx = 0;
+    for (auto _: state) {
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; p++) {
+            threads.emplace_back([&]{
+                for (int i = 0; i < kEvents / producers; i++) {
+                    handler.post(ctx, KindT::make());
+                }
+            });
+        }
+        for (auto& thread: threads) {
+            thread.join();
+        }
+        Completion<void> done;
+        handler.submit(ctx, KindT::make(), done);
+        done.get();
+    }
+    state.SetItemsProcessed(state.iterations() * kEvents);
+}
+BENCHMARK_TEMPLATE(BM_Buffered, Trivial)->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Buffered, String)->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Buffered, MoveOnly)->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+
+// Round trip of one event to an idle worker and its Completion back, per WaitStrategy
+// (state.range(0) in declaration order). Spinning only pays off with a core to spare for
+// the worker, on a single core it competes with the producer for it.
+static void BM_Handoff(benchmark::State& state) {
+    WorkerOptions options;
+    options.wait = static_cast<WaitStrategy>(state.range(0));
+    auto handler = Buffered{[](int& ctx, Tick event){return event.value;}, QueueLimits{}, options};
+    int ctx = 0;
+    Completion<int> done;
+    for (auto _: state) {
+        handler.submit(ctx, Tick{1}, done);
+        benchmark::DoNotOptimize(done.get());
+    }
+}
+BENCHMARK(BM_Handoff)->DenseRange(0, 3)->UseRealTime();
+
+namespace {
+    struct Keyed {
+        int key;
+        int value;
+    };
+
+    // Roughly a microsecond of work per event.
+    int busy_work(int value) {
+        for (int i = 0; i < 500; i++) {
+            benchmark::DoNotOptimize(value = value * 31 + i);
+        }
+        return value;
+    }
+
+    template<typename HandlerT>
+    void run_keyed(benchmark::State& state, HandlerT& handler) {
+        constexpr int kEvents = 1 << 12;
+        constexpr int kKeys = 64;
+        int ctx = 0;
+        for (auto _: state) {
+            for (int i = 0; i < kEvents; i++) {
+                handler.post(ctx, Keyed{i % kKeys, i});
+            }
+            std::vector<Completion<void>> done(kKeys);
+            for (int key = 0; key < kKeys; key++) {
+                handler.submit(ctx, Keyed{key, 0}, done[key]);
+            }
+            for (auto& d: done) {
+                d.get();
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * kEvents);
+    }
+}
+
+static void BM_UnshardedWork(benchmark::State& state) {
+    auto handler = Buffered {
+        [](int& ctx, Keyed event){benchmark::DoNotOptimize(busy_work(event.value));},
+    };
+    run_keyed(state, handler);
+}
+BENCHMARK(BM_UnshardedWork)->UseRealTime();
+
+template<std::size_t N>
+static void BM_ShardedWork(benchmark::State& state) {
+    auto handler = Sharded {
+        shards<N>,
+        [](const Keyed& event){return event.key;},
+        [](int& ctx, Keyed event){benchmark::DoNotOptimize(busy_work(event.value));},
+    };
+    run_keyed(state, handler);
+}
+BENCHMARK_TEMPLATE(BM_ShardedWork, 2)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ShardedWork, 4)->UseRealTime();
+
+// Three stages of busy_work per event, all on one worker or one stage per thread.
+template<typename HandlerT>
+static void run_staged(benchmark::State& state, HandlerT& handler) {
+    constexpr int kEvents = 1 << 12;
+    int ctx = 0;
+    for (auto _: state) {
+        for (int i = 0; i < kEvents; i++) {
+            handler(ctx, i);
+        }
+        Completion<void> done;
+        handler.submit(ctx, 0, done);
+        done.get();
+    }
+    state.SetItemsProcessed(state.iterations() * kEvents);
+}
+
+static void BM_UnpipelinedWork(benchmark::State& state) {
+    auto handler = Buffered {
+        [](int& ctx, int value){benchmark::DoNotOptimize(busy_work(busy_work(busy_work(value))));},
+    };
+    run_staged(state, handler);
+}
+BENCHMARK(BM_UnpipelinedWork)->UseRealTime();
+
+static void BM_PipelinedWork(benchmark::State& state) {
+    auto handler = Pipeline {
+        [](int& ctx, int value){return busy_work(value);},
+        [](int& ctx, int value){return busy_work(value);},
+        [](int& ctx, int value){benchmark::DoNotOptimize(busy_work(value));},
+    };
+    run_staged(state, handler);
+}
+BENCHMARK(BM_PipelinedWork)->UseRealTime();
+
+namespace {
+    template<typename ConsumerT, std::size_t...Is>
+    auto make_fan_out(ConsumerT consumer, std::index_sequence<Is...>) {
+        return Serial{((void)Is, Buffered{consumer})...};
+    }
+
+    template<typename ConsumerT, std::size_t...Is>
+    auto make_broadcast(ConsumerT consumer, std::index_sequence<Is...>) {
+        return Broadcast{((void)Is, consumer)...};
+    }
+}
+
+template<typename HandlerT>
+static void run_fan_out(benchmark::State& state, HandlerT& handler, std::atomic<std::int64_t>& handled, std::int64_t consumers) {
+    constexpr int kEvents = 1 << 10;
+    int ctx = 0;
+    std::int64_t expected = 0;
+    for (auto _: state) {
+        for (int i = 0; i < kEvents; i++) {
+            handler(ctx, String::make());
+        }
+        expected += kEvents * consumers;
+        while (handled.load() < expected) {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kEvents);
+}
+
+template<std::size_t N>
+static void BM_BufferedFanOut(benchmark::State& state) {
+    std::atomic<std::int64_t> handled{0};
+    auto consumer = [&](int& ctx, const std::string& event){handled.fetch_add(1, std::memory_order_relaxed);};
+    auto handler = make_fan_out(consumer, std::make_index_sequence<N>{});
+    run_fan_out(state, handler, handled, N);
+}
+BENCHMARK_TEMPLATE(BM_BufferedFanOut, 1)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BufferedFanOut, 2)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BufferedFanOut, 4)->UseRealTime();
+
+template<std::size_t N>
+static void BM_BroadcastFanOut(benchmark::State& state) {
+    std::atomic<std::int64_t> handled{0};
+    auto consumer = [&](int& ctx, const std::string& event){handled.fetch_add(1, std::memory_order_relaxed);};
+    auto handler = make_broadcast(consumer, std::make_index_sequence<N>{});
+    run_fan_out(state, handler, handled, N);
+}
+BENCHMARK_TEMPLATE(BM_BroadcastFanOut, 1)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BroadcastFanOut, 2)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BroadcastFanOut, 4)->UseRealTime();
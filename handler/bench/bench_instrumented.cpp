@@ -0,0 +1,63 @@
+#include "benchmark/benchmark.h"
+#include "event/instrumented.h"
+#include "event/serial.h"
+
+// Cost of wrapping a cheap handler in Instrumented. state.range(0) is sample_every for
+// the instrumented runs. Build with -DEVENT_DISABLE_INSTRUMENTATION to check the wrapped
+// runs match the bare one.
+
+namespace {
+    struct Tick {
+        int value;
+    };
+
+    auto make_handler() {
+        return [](int& ctx, const Tick& event){benchmark::DoNotOptimize(ctx += event.value);};
+    }
+}
+
+static void BM_Bare(benchmark::State& state) {
+    auto handler = Serial {make_handler()};
+    int ctx = 0;
+    for (auto _: state) {
+        handler(ctx, Tick{1});
+    }
+}
+BENCHMARK(BM_Bare);
+
+static void BM_Instrumented(benchmark::State& state) {
+    auto handler = Serial {Instrumented{"bench", make_handler(), static_cast<std::uint32_t>(state.range(0))}};
+    int ctx = 0;
+    for (auto _: state) {
+        handler(ctx, Tick{1});
+    }
+}
+BENCHMARK(BM_Instrumented)->Arg(1)->Arg(16)->Arg(1024);
+
+// One handler called from several threads, every 16th call timed.
+static void BM_InstrumentedThreads(benchmark::State& state) {
+    static auto handler = Instrumented{"bench_threads", make_handler(), 16};
+    int ctx = 0;
+    for (auto _: state) {
+        handler(ctx, Tick{1});
+    }
+}
+BENCHMARK(BM_InstrumentedThreads)->Threads(1)->Threads(4);
+
+// What a timed call can't go below.
+static void BM_Clock(benchmark::State& state) {
+    for (auto _: state) {
+        benchmark::DoNotOptimize(std::chrono::steady_clock::now());
+    }
+}
+BENCHMARK(BM_Clock);
+
+static void BM_ReadStats(benchmark::State& state) {
+    auto handler = Instrumented{"bench_read", make_handler()};
+    int ctx = 0;
+    handler(ctx, Tick{1});
+    for (auto _: state) {
+        benchmark::DoNotOptimize(instrumented_stats());
+    }
+}
+BENCHMARK(BM_ReadStats);
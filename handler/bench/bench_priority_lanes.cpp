@@ -0,0 +1,70 @@
+#include <atomic>
+#include <thread>
+
+#include "benchmark/benchmark.h"
+#include "event/buffered.h"
+
+// Queueing delay of urgent events while a background thread floods the same Buffered
+// with low priority work. state.range(0) is the lane count, 1 being a plain FIFO, and
+// state.range(1) is 0 for Strict and 1 for WeightedFair. The p50/p99 counters are the
+// urgent lane's queueing delay in nanoseconds.
+
+namespace {
+    struct Log {
+        int value;
+    };
+
+    struct Input {
+        int value;
+    };
+
+    // Roughly a microsecond of work per event.
+    int busy_work(int value) {
+        for (int i = 0; i < 500; i++) {
+            benchmark::DoNotOptimize(value = value * 31 + i);
+        }
+        return value;
+    }
+}
+
+template<>
+struct event_priority<Input> {
+    static constexpr unsigned value = 1;
+};
+
+static void BM_UrgentDelay(benchmark::State& state) {
+    constexpr int kUrgent = 256;
+    PriorityLanes lanes{static_cast<std::size_t>(state.range(0))};
+    lanes.scheduling = state.range(1) ? LaneScheduling::WeightedFair : LaneScheduling::Strict;
+    struct Handler {
+        void operator()(int& ctx, Log event) {benchmark::DoNotOptimize(busy_work(event.value));}
+        void operator()(int& ctx, Input event) {benchmark::DoNotOptimize(busy_work(event.value));}
+    };
+    auto handler = Buffered{Handler{}, QueueLimits{4096, 0, Overflow::Block}, lanes};
+
+    int ctx = 0;
+    std::atomic<bool> stop{false};
+    std::thread background([&]{
+        int background_ctx = 0;
+        while (!stop) {
+            handler.post(background_ctx, Log{1});
+        }
+    });
+
+    for (auto _: state) {
+        for (int i = 0; i < kUrgent; i++) {
+            Completion<void> done;
+            handler.submit(ctx, Input{i}, done);
+            done.get();
+        }
+    }
+    stop = true;
+    background.join();
+
+    // With one lane the urgent events share lane 0 with the background ones.
+    LatencyHistogram delay = handler.queue_delay(handler.lane_count() - 1);
+    state.counters["p50_ns"] = static_cast<double>(delay.percentile(0.5));
+    state.counters["p99_ns"] = static_cast<double>(delay.percentile(0.99));
+    state.SetItemsProcessed(state.iterations() * kUrgent);
+}
+BENCHMARK(BM_UrgentDelay)->Args({1, 0})->Args({2, 0})->Args({2, 1})->UseRealTime();
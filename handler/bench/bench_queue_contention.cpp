@@ -0,0 +1,134 @@
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "event/job_ring.h"
+
+// Compares the queue detail::Worker used to have (boxed jobs in a std::deque behind a
+// std::mutex) against the JobRing it queues on now, with a varying number of producers
+// and one consumer.
+
+namespace {
+    constexpr std::size_t kCapacity = 1024;
+    constexpr int kItemsPerIteration = 1 << 16;
+
+    // Stands in for a Buffered job, the payload for the event it carries.
+    struct Job {
+        std::unique_ptr<int> payload;
+
+        void operator()() {benchmark::DoNotOptimize(payload.get());}
+    };
+
+    class MutexDeque {
+    public:
+        explicit MutexDeque(std::size_t capacity): capacity(capacity) {}
+
+        // Leaves job alone if the queue is full.
+        bool try_push(Job& job) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (buffer.size() >= capacity) {
+                return false;
+            }
+            buffer.push_back(std::make_unique<Boxed>(std::move(job)));
+            return true;
+        }
+
+        std::size_t run() {
+            std::unique_ptr<IJob> job;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (buffer.empty()) {
+                    return 0;
+                }
+                job = std::move(buffer.front());
+                buffer.pop_front();
+            }
+            job->run();
+            return 1;
+        }
+
+    private:
+        struct IJob {
+            virtual ~IJob() = default;
+            virtual void run() = 0;
+        };
+
+        struct Boxed: IJob {
+            explicit Boxed(Job job): job(std::move(job)) {}
+            void run() override {job();}
+            Job job;
+        };
+
+        std::deque<std::unique_ptr<IJob>> buffer;
+        std::mutex mutex;
+        std::size_t capacity;
+    };
+
+    template<Producers P>
+    class Ring {
+    public:
+        explicit Ring(std::size_t capacity): ring(capacity) {}
+
+        // try_push doesn't touch the job unless there is room for it.
+        bool try_push(Job& job) {return ring.try_push(std::move(job));}
+
+        std::size_t run() {return ring.run_batch();}
+
+    private:
+        JobRing<P> ring;
+    };
+
+    template<typename QueueT>
+    void run_contention(benchmark::State& state) {
+        const int producers = static_cast<int>(state.range(0));
+        const int per_producer = kItemsPerIteration / producers;
+
+        for (auto _: state) {
+            QueueT queue(kCapacity);
+            std::vector<std::thread> threads;
+            for (int p = 0; p < producers; p++) {
+                threads.emplace_back([&queue, per_producer]{
+                    for (int i = 0; i < per_producer; i++) {
+                        Job job{std::make_unique<int>(i)};
+                        while (!queue.try_push(job)) {
+                            std::this_thread::yield();
+                        }
+                    }
+                });
+            }
+
+            for (int received = 0; received < per_producer * producers;) {
+                if (std::size_t ran = queue.run()) {
+                    received += static_cast<int>(ran);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+
+            for (auto& thread: threads) {
+                thread.join();
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * per_producer * producers);
+    }
+
+    void BM_MutexDeque(benchmark::State& state) {
+        run_contention<MutexDeque>(state);
+    }
+
+    void BM_JobRingMpsc(benchmark::State& state) {
+        run_contention<Ring<Producers::Multi>>(state);
+    }
+
+    void BM_JobRingSpsc(benchmark::State& state) {
+        run_contention<Ring<Producers::Single>>(state);
+    }
+}
+
+BENCHMARK(BM_MutexDeque)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+BENCHMARK(BM_JobRingMpsc)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+// Only valid with one producer.
+BENCHMARK(BM_JobRingSpsc)->Arg(1)->UseRealTime();
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""Compile time and peak compiler memory of Serial/First dispatch with many handlers.
+
+Generates a translation unit with N lambdas spread over a handful of event types,
+wraps them all in one Serial and one First and dispatches every event type through
+both, then compiles it and reports wall time and the compiler's peak RSS.
+
+    bazel run //handler:bench_compile_time -- --handlers 50 200 1000 --json out.json
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HANDLER_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def generate(handlers, event_types):
+    lines = ['#include <optional>', '#include "event/serial.h"', '#include "event/first.h"', '']
+    for e in range(event_types):
+        lines.append(f'struct E{e} {{ int v; }};')
+    lines += ['', 'int run() {', '    int ctx = 0;', '    auto events = Serial {']
+    for h in range(handlers):
+        lines.append(f'        [](int& ctx, const E{h % event_types}& e){{ctx += e.v + {h};}},')
+    lines += ['    };', '    auto requests = First {']
+    for h in range(handlers):
+        lines.append(f'        [](int& ctx, const E{h % event_types}& e) -> std::optional<int> {{'
+                     f'if (e.v == {h}) {{return {h};}} return std::nullopt;}},')
+    lines.append('    };')
+    for e in range(event_types):
+        lines.append(f'    events(ctx, E{e}{{{e}}});')
+        lines.append(f'    ctx += requests(ctx, E{e}{{{e}}}).value_or(0);')
+    lines += ['    return ctx;', '}', '']
+    return '\n'.join(lines)
+
+
+def compile_once(compiler, flags, source, workdir):
+    src = os.path.join(workdir, 'generated.cpp')
+    with open(src, 'w') as f:
+        f.write(source)
+    cmd = [compiler, *flags, '-I', workdir, '-c', src, '-o', os.path.join(workdir, 'generated.o')]
+    start = time.monotonic()
+    proc = subprocess.Popen(cmd, stderr=subprocess.PIPE)
+    # wait4 gives the rusage of this child alone.
+    _, status, usage = os.wait4(proc.pid, 0)
+    seconds = time.monotonic() - start
+    stderr = proc.stderr.read().decode()
+    proc.stderr.close()
+    if os.waitstatus_to_exitcode(status) != 0:
+        sys.exit(f'compile failed:\n{stderr[:4000]}')
+    # ru_maxrss is in kilobytes on Linux.
+    return seconds, usage.ru_maxrss / 1024
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--handlers', type=int, nargs='+', default=[50, 200, 1000])
+    parser.add_argument('--event-types', type=int, default=10)
+    parser.add_argument('--compiler', default=os.environ.get('CXX', 'g++'))
+    parser.add_argument('--flags', default='-std=c++17 -O0', help='compiler flags, one string')
+    parser.add_argument('--repetitions', type=int, default=1, help='best of this many compiles')
+    parser.add_argument('--json', help='also write the results to this file')
+    args = parser.parse_args()
+
+    workdir = tempfile.mkdtemp()
+    try:
+        # The headers are included as event/..., the same as with the bazel include_prefix.
+        os.symlink(HANDLER_DIR, os.path.join(workdir, 'event'))
+        results = []
+        for n in args.handlers:
+            source = generate(n, args.event_types)
+            runs = [compile_once(args.compiler, args.flags.split(), source, workdir) for _ in range(args.repetitions)]
+            seconds = min(r[0] for r in runs)
+            peak_mb = min(r[1] for r in runs)
+            results.append({'handlers': n, 'event_types': args.event_types, 'seconds': round(seconds, 3), 'peak_rss_mb': round(peak_mb, 1)})
+            print(f'{n:>6} handlers  {seconds:8.2f} s  {peak_mb:8.1f} MB', flush=True)
+    finally:
+        shutil.rmtree(workdir)
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({'compiler': args.compiler, 'flags': args.flags, 'results': results}, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "meta.h"
+#include "producers.h"
+#include "job_ring.h"
+
+// How many events a Broadcast holds before the producer waits for the slowest consumer,
+// rounded up to a power of two.
+struct BroadcastCapacity {
+    std::size_t slots = 1024;
+};
+
+namespace detail {
+    template<typename StateT>
+    struct BroadcastOps {
+        using DeliverFn = void(*)(StateT& state, void* ctx, const unsigned char* storage);
+
+        void (*destroy)(unsigned char* storage);
+        // One per consumer, a no-op for consumers that don't take the event.
+        std::array<DeliverFn, StateT::consumer_count> deliver;
+    };
+
+    struct alignas(cache_line) BroadcastSlot {
+        static constexpr std::size_t inline_bytes = cache_line - 2 * sizeof(void*);
+
+        const void* ops = nullptr;
+        void* ctx = nullptr;
+        alignas(alignof(std::max_align_t)) unsigned char storage[inline_bytes];
+    };
+
+    template<typename StateT, typename CtxT, typename EventT>
+    struct BroadcastEvent {
+        // Events that don't fit in a slot are boxed, the box is still shared by every consumer.
+        static constexpr bool boxed = sizeof(EventT) > BroadcastSlot::inline_bytes || alignof(EventT) > alignof(std::max_align_t);
+        using StoredT = std::conditional_t<boxed, std::unique_ptr<EventT>, EventT>;
+
+        static void construct(unsigned char* storage, EventT&& event) {
+            if constexpr (boxed) {
+                new (storage) StoredT(std::make_unique<EventT>(std::move(event)));
+            } else {
+                new (storage) StoredT(std::move(event));
+            }
+        }
+
+        static const EventT& get(const unsigned char* storage) {
+            auto& stored = *std::launder(reinterpret_cast<const StoredT*>(storage));
+            if constexpr (boxed) {
+                return *stored;
+            } else {
+                return stored;
+            }
+        }
+
+        static void destroy(unsigned char* storage) {
+            std::launder(reinterpret_cast<StoredT*>(storage))->~StoredT();
+        }
+
+        template<std::size_t I>
+        static void deliver(StateT& state, void* ctx, const unsigned char* storage) {
+            using ConsumerT = std::tuple_element_t<I, typename StateT::Consumers>;
+            if constexpr (dispatch_match_v<ConsumerT, CtxT&, const EventT&>) {
+                try {
+                    std::get<I>(state.consumers)(*static_cast<CtxT*>(ctx), get(storage));
+                } catch (...) {
+                    // nobody to report to, like Buffered::post
+                }
+            }
+        }
+
+        template<std::size_t...Is>
+        static constexpr BroadcastOps<StateT> make_ops(std::index_sequence<Is...>) {
+            return BroadcastOps<StateT>{&destroy, {&deliver<Is>...}};
+        }
+
+        static constexpr BroadcastOps<StateT> ops = make_ops(std::make_index_sequence<StateT::consumer_count>{});
+    };
+
+    template<typename...ConsumerTs>
+    class BroadcastState {
+    public:
+        using Consumers = std::tuple<ConsumerTs...>;
+
+        static constexpr std::size_t consumer_count = sizeof...(ConsumerTs);
+
+        BroadcastState(std::size_t capacity_slots, ConsumerTs...consumers):
+            consumers(std::move(consumers)...),
+            slot_count(next_pow2(std::max<std::size_t>(capacity_slots, 2))),
+            slots(std::make_unique<BroadcastSlot[]>(slot_count)),
+            cursors(std::make_unique<Cursor[]>(consumer_count))
+        {
+            for (std::size_t i = 0; i < consumer_count; i++) {
+                threads.emplace_back([this, i]{run(i);});
+            }
+        }
+
+        ~BroadcastState() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cv.notify_all();
+            for (auto& thread: threads) {
+                thread.join();
+            }
+            // Events no consumer got to are dropped, like Buffered's.
+            for (std::size_t i = 0; i < slot_count; i++) {
+                if (slots[i].ops) {
+                    static_cast<const BroadcastOps<BroadcastState>*>(slots[i].ops)->destroy(slots[i].storage);
+                }
+            }
+        }
+
+        // Producer only.
+        template<typename CtxT, typename EventT>
+        void publish(CtxT& ctx, EventT&& event) {
+            using Stored = BroadcastEvent<BroadcastState, CtxT, remove_cvref_t<EventT>>;
+            std::uint64_t seq = next;
+            if (seq - gate >= slot_count) {
+                wait_for_slot(seq);
+            }
+
+            // Every consumer is past whatever was in the slot before.
+            BroadcastSlot& slot = slots[seq & (slot_count - 1)];
+            if (slot.ops) {
+                static_cast<const BroadcastOps<BroadcastState>*>(slot.ops)->destroy(slot.storage);
+                slot.ops = nullptr;
+            }
+            Stored::construct(slot.storage, std::move(event));
+            slot.ctx = &ctx;
+            slot.ops = &Stored::ops;
+            next = seq + 1;
+            published.store(next, std::memory_order_release);
+
+            // Same handshake as Buffered's sleeping flag.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleepers.load(std::memory_order_relaxed)) {
+                { std::lock_guard<std::mutex> lock(mutex); }
+                cv.notify_all();
+            }
+        }
+
+        // Producer only.
+        void drain() {
+            for (std::size_t i = 0; i < consumer_count; i++) {
+                while (cursors[i].next.load(std::memory_order_acquire) < next) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        std::uint64_t published_count() const {return published.load(std::memory_order_relaxed);}
+
+        std::uint64_t lag(std::size_t consumer) const {
+            if (consumer >= consumer_count) {
+                return 0;
+            }
+            std::uint64_t read = cursors[consumer].next.load(std::memory_order_relaxed);
+            std::uint64_t total = published.load(std::memory_order_relaxed);
+            return total > read ? total - read : 0;
+        }
+
+        std::uint64_t producer_waits() const {return waits.load(std::memory_order_relaxed);}
+
+        std::size_t capacity_slots() const {return slot_count;}
+
+        Consumers consumers;
+
+    private:
+        // Next sequence the consumer will read, each on its own cache line.
+        struct alignas(cache_line) Cursor {
+            std::atomic<std::uint64_t> next{0};
+        };
+
+        // The producer waits on the slowest consumer, the gate is the oldest cursor it
+        // saw last time so it only reads the cursors again once it catches up with it.
+        void wait_for_slot(std::uint64_t seq) {
+            for (bool waited = false;; waited = true) {
+                std::uint64_t slowest = seq;
+                for (std::size_t i = 0; i < consumer_count; i++) {
+                    slowest = std::min(slowest, cursors[i].next.load(std::memory_order_acquire));
+                }
+                gate = slowest;
+                if (seq - gate < slot_count) {
+                    return;
+                }
+                if (!waited) {
+                    waits.fetch_add(1, std::memory_order_relaxed);
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        void run(std::size_t consumer) {
+            auto& cursor = cursors[consumer].next;
+            std::uint64_t seq = 0;
+            while (true) {
+                std::uint64_t available = published.load(std::memory_order_acquire);
+                if (seq == available) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    sleepers.fetch_add(1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    cv.wait(lock, [&]{return stop || published.load(std::memory_order_relaxed) != seq;});
+                    sleepers.fetch_sub(1, std::memory_order_relaxed);
+                    if (stop) {
+                        return;
+                    }
+                    continue;
+                }
+
+                // Reads everything published so far in place, then lets the producer
+                // have the slots back in one store.
+                for (; seq != available && !stop.load(std::memory_order_relaxed); seq++) {
+                    const BroadcastSlot& slot = slots[seq & (slot_count - 1)];
+                    static_cast<const BroadcastOps<BroadcastState>*>(slot.ops)->deliver[consumer](*this, slot.ctx, slot.storage);
+                }
+                cursor.store(seq, std::memory_order_release);
+                if (stop.load(std::memory_order_relaxed)) {
+                    return;
+                }
+            }
+        }
+
+        std::size_t slot_count;
+        std::unique_ptr<BroadcastSlot[]> slots;
+        std::unique_ptr<Cursor[]> cursors;
+        alignas(cache_line) std::atomic<std::uint64_t> published{0};
+        // Producer only.
+        alignas(cache_line) std::uint64_t next = 0;
+        std::uint64_t gate = 0;
+        std::atomic<std::uint64_t> waits{0};
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::atomic<int> sleepers{0};
+        std::atomic<bool> stop{false};
+        // Last so they start once everything they use is constructed.
+        std::vector<std::thread> threads;
+    };
+}
+
+// Hands every event to several consumers, each on a thread of its own, through one
+// shared ring. An event is moved into the ring once and every consumer reads it in
+// place as a const EventT&, so the copies and allocations per event stay the same
+// however many consumers there are, where a Buffered per consumer copies the event into
+// each of their queues.
+//
+//     auto handler = Broadcast{
+//         [](Ctx& ctx, const Frame& frame){record(frame);},
+//         [](Ctx& ctx, const Frame& frame){stream(frame);},
+//     };
+//
+// Each consumer keeps its own cursor into the ring and handles events in the order they
+// were posted, consumers that don't take an event's type skip it. Once the ring is
+// full the producer waits for the slowest consumer, so a stalled consumer holds the
+// producer up rather than being overrun. Only one thread may post at a time, normally
+// the main thread. Exceptions from consumers are swallowed like Buffered::post's.
+//
+// Events are stored inline in cache line sized slots, ones bigger than
+// BroadcastSlot::inline_bytes are boxed on the heap, still once per event. An event is
+// destroyed when the producer reuses its slot, not when the last consumer is done with
+// it.
+template<typename...ConsumerTs>
+class Broadcast {
+    static_assert(sizeof...(ConsumerTs) > 0, "Broadcast needs at least one consumer");
+
+public:
+    template<typename CtxT, typename EventT>
+    static constexpr bool accepts_v = (dispatch_match_v<ConsumerTs, CtxT&, const remove_cvref_t<EventT>&> || ...);
+
+    Broadcast(ConsumerTs...consumers):
+        Broadcast(BroadcastCapacity{}, std::move(consumers)...)
+        {}
+
+    Broadcast(BroadcastCapacity capacity, ConsumerTs...consumers):
+        state(std::make_unique<detail::BroadcastState<ConsumerTs...>>(capacity.slots, std::move(consumers)...))
+        {}
+
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    void operator()(CtxT& ctx, EventT event) {
+        state->publish(ctx, std::move(event));
+    }
+
+    // Waits until every consumer has handled everything posted so far, e.g. before
+    // freeing what the events point to. Producer only.
+    void drain() {state->drain();}
+
+    std::uint64_t published() const {return state->published_count();}
+
+    // Events posted that the consumer hasn't handled yet.
+    std::uint64_t lag(std::size_t consumer) const {return state->lag(consumer);}
+
+    // Times the producer found the ring full and had to wait for a consumer.
+    std::uint64_t producer_waits() const {return state->producer_waits();}
+
+    std::size_t capacity_slots() const {return state->capacity_slots();}
+
+    static constexpr std::size_t consumer_count() {return sizeof...(ConsumerTs);}
+
+private:
+    std::unique_ptr<detail::BroadcastState<ConsumerTs...>> state;
+};
+
+template<typename...ConsumerTs>
+Broadcast(ConsumerTs...) -> Broadcast<ConsumerTs...>;
+
+template<typename...ConsumerTs>
+Broadcast(BroadcastCapacity, ConsumerTs...) -> Broadcast<ConsumerTs...>;
@@ -1,51 +1,160 @@
 #pragma once
 
 #include <thread>
-#include <deque>
+#include <algorithm>
+#include <utility>
+#include <vector>
 #include <condition_variable>
+#include <deque>
 #include <mutex>
 #include <atomic>
+#include <chrono>
 #include <future>
 #include <memory>
+#include <optional>
 #include <exception>
+#include <string>
+#include <system_error>
 #include <type_traits>
+#include <cerrno>
 #include <cstdint>
 
 #include "meta.h"
+#include "producers.h"
+#include "job_ring.h"
+#include "pool_allocator.h"
+#include "completion.h"
+#include "future.h"
+#include "queue_limits.h"
+#include "executor.h"
+#include "span.h"
+#include "histogram.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace detail {
-    class IJob {
-    public:
-        virtual ~IJob() = default;
-        virtual void run() = 0;
-    };
+    // Used when the queue has no budget. Jobs that don't fit in a ring of this size
+    // spill over to the heap, see Worker::spill.
+    inline constexpr std::size_t default_queue_slots = 1024;
 
-    template<class LambdaT>
-    class Job: public IJob {
-    public:
-        Job(LambdaT lambda): lambda(std::move(lambda)) {}
-        void run() override {
-            lambda();
+    // Most slots preallocated for a ring with a budget, 256KB.
+    inline constexpr std::size_t max_queue_slots = 4 * default_queue_slots;
+
+    template<Producers P>
+    std::size_t queue_slots(const QueueLimits& limits) {
+        if (!limits.bounded()) {
+            return default_queue_slots;
         }
-    private:
-        LambdaT lambda;
-    };
+        // Enough for the budget if its jobs are small, big budgets get a ring of
+        // max_queue_slots and the jobs past it spill over like unbounded ones do. The
+        // budget is what bounds the queue either way.
+        std::size_t slots = std::max(
+            limits.max_jobs * JobRing<P>::max_inline_slots,
+            limits.max_bytes / JobRing<P>::slot_size + JobRing<P>::max_inline_slots
+        );
+        return std::min(limits.overflow == Overflow::DropOldest ? 2 * slots : slots, max_queue_slots);
+    }
+
+    // Most jobs a strand runs before giving its executor thread to other tasks.
+    inline constexpr std::size_t strand_batch = max_job_batch;
+
+    // Tells the core we're spinning, so a hyperthread sibling gets the pipeline.
+    inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    // Applies the cpu and name of options to thread, returns 0 or an errno value.
+    inline int configure_thread(std::thread& thread, const WorkerOptions& options) {
+#ifdef __linux__
+        if (options.cpu >= 0) {
+            if (options.cpu >= CPU_SETSIZE) {
+                return EINVAL;
+            }
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(options.cpu, &set);
+            if (int error = pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set)) {
+                return error;
+            }
+        }
+        if (!options.name.empty()) {
+            return pthread_setname_np(thread.native_handle(), options.name.substr(0, 15).c_str());
+        }
+#else
+        (void) thread;
+        (void) options;
+#endif
+        return 0;
+    }
 
+    // Runs jobs one at a time in FIFO order, either on its own thread or, given an
+    // executor, as a strand: a task that is scheduled on the executor whenever it has
+    // jobs and is never scheduled twice, so its jobs keep the same ordering.
+    //
+    // Given PriorityLanes each lane is a ring of its own and FIFO within itself, the
+    // worker picks which lane to take jobs from next. Jobs are then stamped when queued
+    // so the worker can record their queueing delay per lane.
+    template<Producers P>
     class Worker {
     public:
-        Worker(std::size_t max_queue_size):
-            buffer(),
+        Worker(QueueLimits limits, Executor* executor = nullptr, std::optional<PriorityLanes> lanes = std::nullopt, WorkerOptions options = {}):
+            rings(make_rings(limits, lanes ? lanes->count : 1)),
+            delays(lanes ? std::make_unique<AtomicLatencyHistogram[]>(rings.size()) : nullptr),
+            lanes(lanes.value_or(PriorityLanes{})),
+            skipped(rings.size(), 0),
+            fair_lane(rings.size() - 1),
+            fair_credit(this->lanes.weight(rings.size() - 1)),
             mutex(),
             cv(),
+            room_mutex(),
+            room_cv(),
             stop(false),
-            max_queue_size(max_queue_size),
-            thread([this]{run();})
-            {}
+            sleeping(false),
+            waiting_for_room(0),
+            pending_jobs(0),
+            pending_bytes(0),
+            dropped_newest(0),
+            dropped_oldest(0),
+            rejected(0),
+            blocked(0),
+            limits(limits),
+            executor(executor),
+            options(std::move(options)),
+            strand_task{{&Worker::run_strand_task}, this},
+            scheduled(false),
+            strand_runs(0),
+            spills(rings.size()),
+            spilled(0),
+            thread(executor ? std::thread() : std::thread([this]{run();}))
+        {
+            if (executor) {
+                return;
+            }
+            if (int error = configure_thread(thread, this->options)) {
+                shutdown();
+                throw std::system_error(error, std::generic_category(), "failed to configure Buffered worker thread");
+            }
+        }
 
         ~Worker() {
-            stop = true;
-            cv.notify_one();
-            thread.join();
+            if (executor) {
+                stop = true;
+            } else {
+                shutdown();
+            }
+            // Jobs still queued give their budget back when they are destroyed, so they
+            // go now while the rest of the worker is alive rather than with the rings.
+            // Destroying one can post another, e.g. from a broken promise's continuation.
+            do {
+                wait_for_strand();
+            } while (drop_queued());
         }
 
         Worker(const Worker&) = delete;
@@ -54,77 +163,836 @@ namespace detail {
         Worker& operator=(const Worker&) = delete;
         Worker& operator=(Worker&&) = delete;
 
+        // Takes a job out of the queue's budget before it is pushed. owned_bytes is any heap
+        // memory the job holds on to. Returns false if the job has to be shed instead, in
+        // which case it must not be pushed.
         template<class FunctionT>
-        void add_job(FunctionT f) {
-            {
-                if (max_queue_size && buffer.size() >= max_queue_size) {
-                    return;
-                }
-                auto job = std::make_unique<detail::Job<FunctionT>>(std::move(f));
-                std::lock_guard<std::mutex> lock(mutex);
-                buffer.emplace_back(std::move(job));
+        bool admit(std::size_t owned_bytes) {
+            if (!limits.bounded()) {
+                return true;
+            }
+            std::size_t bytes = job_bytes<FunctionT>(owned_bytes);
+
+            if (limits.overflow == Overflow::DropOldest) {
+                // the worker sheds old jobs to make room
+                reserve(bytes);
+                return true;
+            }
+
+            if (try_reserve(bytes)) {
+                return true;
+            }
+
+            switch (limits.overflow) {
+            case Overflow::Block:
+                wait_for_room(bytes);
+                return true;
+            case Overflow::Reject:
+                rejected.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            default:
+                dropped_newest.fetch_add(1, std::memory_order_relaxed);
+                return false;
             }
-            cv.notify_one();
+        }
+
+        // Queues a job that was admitted with the same owned_bytes. Priorities past the
+        // last lane go into the last lane.
+        template<class FunctionT>
+        void push(FunctionT f, std::size_t owned_bytes, unsigned priority = 0) {
+            std::size_t lane = std::min<std::size_t>(priority, rings.size() - 1);
+            if (delays) {
+                push_accounted(Stamped<FunctionT>{std::move(f), &delays[lane], std::chrono::steady_clock::now()}, owned_bytes, lane);
+            } else {
+                push_accounted(std::move(f), owned_bytes, lane);
+            }
+        }
+
+        const QueueLimits& queue_limits() const {return limits;}
+
+        std::size_t lane_count() const {return rings.size();}
+
+        // How long the jobs taken from lane so far waited in the queue. Only recorded
+        // given PriorityLanes.
+        LatencyHistogram queue_delay(std::size_t lane) const {
+            LatencyHistogram histogram;
+            if (delays && lane < rings.size()) {
+                delays[lane].add_to(histogram);
+            }
+            return histogram;
+        }
+
+        QueueStats stats() const {
+            QueueStats s;
+            s.pending_jobs = pending_jobs.load(std::memory_order_relaxed);
+            s.pending_bytes = pending_bytes.load(std::memory_order_relaxed);
+            s.dropped_newest = dropped_newest.load(std::memory_order_relaxed);
+            s.dropped_oldest = dropped_oldest.load(std::memory_order_relaxed);
+            s.rejected = rejected.load(std::memory_order_relaxed);
+            s.blocked = blocked.load(std::memory_order_relaxed);
+            return s;
         }
 
     private:
-        std::deque<std::unique_ptr<detail::IJob>> buffer;
+        struct StrandTask: Task {
+            Worker* worker;
+        };
+
+        // Gives a job's budget back when it is destroyed, whether or not it was run.
+        template<class FunctionT>
+        struct Accounted {
+            FunctionT f;
+            Worker* worker;
+            std::size_t bytes;
+
+            Accounted(FunctionT f, Worker* worker, std::size_t bytes): f(std::move(f)), worker(worker), bytes(bytes) {}
+            Accounted(Accounted&& other): f(std::move(other.f)), worker(std::exchange(other.worker, nullptr)), bytes(other.bytes) {}
+            Accounted& operator=(Accounted&&) = delete;
+
+            ~Accounted() {
+                if (worker) {
+                    worker->release(bytes);
+                }
+            }
+
+            void operator()() {f();}
+
+            static constexpr bool batchable = is_batchable_job<FunctionT>::value;
+            static void run_batch(Accounted** jobs, std::size_t count) {
+                run_inner_batch<Accounted, FunctionT>(jobs, count, [](Accounted& job) -> FunctionT& {return job.f;});
+            }
+        };
+
+        // A job that didn't fit in its ring, boxed on the heap.
+        struct SpilledJob {
+            virtual ~SpilledJob() = default;
+            virtual void run() = 0;
+        };
+
+        template<class FunctionT>
+        struct SpilledJobOf: SpilledJob {
+            FunctionT f;
+
+            explicit SpilledJobOf(FunctionT f): f(std::move(f)) {}
+
+            void run() override {f();}
+        };
+
+        // Records how long a job waited when it's run.
+        template<class FunctionT>
+        struct Stamped {
+            FunctionT f;
+            AtomicLatencyHistogram* delay;
+            std::chrono::steady_clock::time_point queued;
+
+            void record(std::chrono::steady_clock::time_point now) {
+                auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(now - queued).count();
+                // Only the worker records, one thread at a time.
+                delay->record(static_cast<std::uint64_t>(waited), true);
+            }
+
+            void operator()() {
+                record(std::chrono::steady_clock::now());
+                f();
+            }
+
+            static constexpr bool batchable = is_batchable_job<FunctionT>::value;
+            static void run_batch(Stamped** jobs, std::size_t count) {
+                auto now = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i < count; i++) {
+                    jobs[i]->record(now);
+                }
+                run_inner_batch<Stamped, FunctionT>(jobs, count, [](Stamped& job) -> FunctionT& {return job.f;});
+            }
+        };
+
+        // One ring per lane, most urgent last.
+        std::vector<std::unique_ptr<JobRing<P>>> rings;
+        std::unique_ptr<AtomicLatencyHistogram[]> delays;
+        const PriorityLanes lanes;
+        // Lane scheduling state, only touched by the worker.
+        std::vector<std::size_t> skipped;
+        std::size_t fair_lane;
+        std::size_t fair_credit;
         std::mutex mutex;
         std::condition_variable cv;
-        std::atomic<bool> stop{false};
-        std::size_t max_queue_size;
+        std::mutex room_mutex;
+        std::condition_variable room_cv;
+        std::atomic<bool> stop;
+        std::atomic<bool> sleeping;
+        std::atomic<std::size_t> waiting_for_room;
+        std::atomic<std::size_t> pending_jobs;
+        std::atomic<std::size_t> pending_bytes;
+        std::atomic<std::uint64_t> dropped_newest;
+        std::atomic<std::uint64_t> dropped_oldest;
+        std::atomic<std::uint64_t> rejected;
+        std::atomic<std::uint64_t> blocked;
+        const QueueLimits limits;
+        Executor* executor;
+        const WorkerOptions options;
+        StrandTask strand_task;
+        std::atomic<bool> scheduled;
+        // Number of threads inside run_strand, at most two while one is handing over to the next.
+        std::atomic<int> strand_runs;
+        // Jobs spilled over from each lane's ring, and how many there are in all.
+        std::mutex spill_mutex;
+        std::vector<std::deque<std::unique_ptr<SpilledJob>>> spills;
+        std::atomic<std::size_t> spilled;
         std::thread thread;
 
+        static std::vector<std::unique_ptr<JobRing<P>>> make_rings(const QueueLimits& limits, std::size_t count) {
+            std::vector<std::unique_ptr<JobRing<P>>> rings;
+            for (std::size_t i = 0; i < std::max<std::size_t>(count, 1); i++) {
+                rings.push_back(std::make_unique<JobRing<P>>(queue_slots<P>(limits)));
+            }
+            return rings;
+        }
+
+        // What admit reserved for the job, so also what gets released.
+        template<class FunctionT>
+        std::size_t job_bytes(std::size_t owned_bytes) const {
+            if (delays) {
+                return JobRing<P>::template footprint<Accounted<Stamped<FunctionT>>>() + owned_bytes;
+            }
+            return JobRing<P>::template footprint<Accounted<FunctionT>>() + owned_bytes;
+        }
+
+        template<class JobT>
+        void push_accounted(JobT job, std::size_t owned_bytes, std::size_t lane) {
+            if (limits.bounded()) {
+                push_to_ring(Accounted<JobT>{std::move(job), this, JobRing<P>::template footprint<Accounted<JobT>>() + owned_bytes}, lane);
+            } else {
+                push_to_ring(std::move(job), lane);
+            }
+        }
+
+        void reserve(std::size_t bytes) {
+            pending_jobs.fetch_add(1, std::memory_order_relaxed);
+            pending_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        bool try_reserve(std::size_t bytes) {
+            std::size_t jobs = pending_jobs.fetch_add(1, std::memory_order_relaxed);
+            std::size_t old_bytes = pending_bytes.fetch_add(bytes, std::memory_order_relaxed);
+            bool over_jobs = limits.max_jobs && jobs >= limits.max_jobs;
+            // A job bigger than the whole budget is still let into an empty queue,
+            // otherwise it could never be queued at all.
+            bool over_bytes = limits.max_bytes && old_bytes != 0 && old_bytes + bytes > limits.max_bytes;
+            if (over_jobs || over_bytes) {
+                pending_jobs.fetch_sub(1, std::memory_order_relaxed);
+                pending_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+
+        void release(std::size_t bytes) {
+            pending_jobs.fetch_sub(1, std::memory_order_relaxed);
+            pending_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+
+            // Same handshake as sleeping/cv but with the producers waiting.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiting_for_room.load(std::memory_order_relaxed)) {
+                { std::lock_guard<std::mutex> lock(room_mutex); }
+                room_cv.notify_all();
+            }
+        }
+
+        void wait_for_room(std::size_t bytes) {
+            blocked.fetch_add(1, std::memory_order_relaxed);
+            std::unique_lock<std::mutex> lock(room_mutex);
+            waiting_for_room.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            room_cv.wait(lock, [&]{return try_reserve(bytes);});
+            waiting_for_room.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        bool over_budget(std::size_t times = 1) const {
+            return (limits.max_jobs && pending_jobs.load(std::memory_order_relaxed) > times * limits.max_jobs)
+                || (limits.max_bytes && pending_bytes.load(std::memory_order_relaxed) > times * limits.max_bytes);
+        }
+
+        template<class FunctionT>
+        void push_to_ring(FunctionT&& f, std::size_t lane) {
+            if (spilled.load(std::memory_order_acquire) || !rings[lane]->try_push(std::move(f))) {
+                // Admit keeps every other queue within its budget, a DropOldest one only
+                // sheds when the worker runs so it's held to twice its budget here.
+                while (limits.overflow == Overflow::DropOldest && over_budget(2) && !stop.load(std::memory_order_relaxed)) {
+                    std::this_thread::yield();
+                }
+                spill(std::move(f), lane);
+            }
+
+            // Pairs with the fence in run/run_strand, either we see the worker is going to
+            // sleep (or the strand is finishing) or the worker sees the job we just pushed.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (executor) {
+                schedule_strand();
+            } else if (sleeping.load(std::memory_order_relaxed)) {
+                // Taking the lock means the worker is either still before its final
+                // empty check or already waiting on cv, so the notify can't be lost.
+                { std::lock_guard<std::mutex> lock(mutex); }
+                cv.notify_one();
+            }
+        }
+
+        // A full ring mustn't hold producers up, without a budget a handler posting to its
+        // own Buffered would wait on itself. The job goes on the heap instead, and so does
+        // every job after it until the worker has run the ones spilled so far, which keeps
+        // each producer's jobs in order.
+        template<class FunctionT>
+        void spill(FunctionT&& f, std::size_t lane) {
+            auto job = std::make_unique<SpilledJobOf<std::decay_t<FunctionT>>>(std::move(f));
+            std::lock_guard<std::mutex> lock(spill_mutex);
+            spills[lane].push_back(std::move(job));
+            spilled.fetch_add(1, std::memory_order_release);
+        }
+
+        // Runs the spilled jobs of the most urgent lane whose ring has been drained, the
+        // jobs in the ring were queued before them.
+        std::size_t run_spilled() {
+            std::deque<std::unique_ptr<SpilledJob>> jobs;
+            {
+                std::lock_guard<std::mutex> lock(spill_mutex);
+                for (std::size_t lane = rings.size(); lane-- > 0;) {
+                    // A producer that pushed to the ring before spilling did so before
+                    // taking the lock, so has_pending sees its job.
+                    if (!spills[lane].empty() && !rings[lane]->has_pending()) {
+                        jobs.swap(spills[lane]);
+                        spilled.fetch_sub(jobs.size(), std::memory_order_relaxed);
+                        break;
+                    }
+                }
+            }
+            for (auto& job: jobs) {
+                if (stop.load(std::memory_order_relaxed)) {
+                    break;
+                }
+                job->run();
+            }
+            return jobs.size();
+        }
+
+        // Drops the oldest spilled job of a lane whose ring is empty.
+        bool drop_spilled(std::size_t lane) {
+            if (!spilled.load(std::memory_order_acquire)) {
+                return false;
+            }
+            std::unique_ptr<SpilledJob> job;
+            {
+                std::lock_guard<std::mutex> lock(spill_mutex);
+                if (spills[lane].empty() || rings[lane]->has_pending()) {
+                    return false;
+                }
+                job = std::move(spills[lane].front());
+                spills[lane].pop_front();
+                spilled.fetch_sub(1, std::memory_order_relaxed);
+            }
+            // Destroyed outside the lock, breaking its promise can run continuations
+            // that post to this Buffered again.
+            job.reset();
+            return true;
+        }
+
+        // Takes everything that is queued (up to max_job_batch jobs) in one go, or with
+        // lanes whatever the next lane to run allows.
+        std::size_t run_batch(std::size_t max_jobs) {
+            if (spilled.load(std::memory_order_acquire)) {
+                if (std::size_t ran = run_spilled()) {
+                    return ran;
+                }
+            }
+            if (limits.overflow == Overflow::DropOldest) {
+                // Least urgent lanes are shed first.
+                for (std::size_t lane = 0; lane < rings.size(); lane++) {
+                    while (over_budget() && rings[lane]->try_drop_one()) {
+                        dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    while (over_budget() && drop_spilled(lane)) {
+                        dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+            if (rings.size() == 1) {
+                return rings[0]->run_batch(max_jobs, &stop);
+            }
+            if (lanes.scheduling == LaneScheduling::WeightedFair) {
+                return run_fair(max_jobs);
+            }
+            return run_strict(max_jobs);
+        }
+
+        std::size_t run_strict(std::size_t max_jobs) {
+            std::size_t lane = rings.size();
+            while (lane > 0 && rings[lane - 1]->empty()) {
+                lane--;
+            }
+            if (lane == 0) {
+                return 0;
+            }
+            lane--;
+
+            // Every less urgent lane that has jobs is passed over once more, the first
+            // one to reach the limit goes instead.
+            std::size_t starved = lane;
+            for (std::size_t i = 0; i < lane; i++) {
+                if (rings[i]->empty()) {
+                    skipped[i] = 0;
+                } else if (++skipped[i] >= lanes.starvation_limit && lanes.starvation_limit && starved == lane) {
+                    starved = i;
+                }
+            }
+            skipped[starved] = 0;
+            return rings[starved]->run_batch(std::min(max_jobs, std::max<std::size_t>(lanes.batch, 1)), &stop);
+        }
+
+        // Deficit round robin: each lane gets its weight in jobs per turn, a lane that
+        // runs out of jobs gives up the rest of its turn.
+        std::size_t run_fair(std::size_t max_jobs) {
+            for (std::size_t tries = 0; tries <= rings.size(); tries++) {
+                if (fair_credit && !rings[fair_lane]->empty()) {
+                    std::size_t ran = rings[fair_lane]->run_batch(std::min(max_jobs, fair_credit), &stop);
+                    fair_credit -= std::min(ran, fair_credit);
+                    return ran;
+                }
+                fair_lane = fair_lane == 0 ? rings.size() - 1 : fair_lane - 1;
+                fair_credit = lanes.weight(fair_lane);
+            }
+            return 0;
+        }
+
+        // Consumer only.
+        bool all_empty() {
+            if (spilled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            for (auto& ring: rings) {
+                if (!ring->empty()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Safe from any thread.
+        bool has_pending() const {
+            if (spilled.load(std::memory_order_relaxed)) {
+                return true;
+            }
+            for (auto& ring: rings) {
+                if (ring->has_pending()) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void schedule_strand() {
+            if (!scheduled.load(std::memory_order_relaxed) && !scheduled.exchange(true)) {
+                executor->schedule(strand_task);
+            }
+        }
+
+        static void run_strand_task(Task& task) {
+            static_cast<StrandTask&>(task).worker->run_strand();
+        }
+
+        void run_strand() {
+            strand_runs.fetch_add(1);
+            if (!stop.load(std::memory_order_relaxed)) {
+                run_batch(strand_batch);
+            }
+
+            scheduled.store(false);
+            // Once scheduled is false another thread can start running this strand, so
+            // only look at the ring through has_pending which is safe from any thread.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!stop.load() && has_pending()) {
+                schedule_strand();
+            }
+            // Nothing may touch this after here, the destructor might be waiting.
+            strand_runs.fetch_sub(1);
+        }
+
+        // A strand that is queued on the executor will still run, it sees stop and
+        // finishes straight away. On one of the executor's own threads it may be queued
+        // behind this very task, so run tasks instead of waiting for a thread that might
+        // never come.
+        void wait_for_strand() {
+            while (scheduled.load() || strand_runs.load()) {
+                if (!executor->is_current() || !executor->try_run_one()) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        // Destroys every queued job without running it, once nothing runs them any more.
+        // Returns false if there were none.
+        bool drop_queued() {
+            bool dropped = false;
+            for (auto& ring: rings) {
+                while (ring->try_drop_one()) {
+                    dropped = true;
+                }
+            }
+            std::vector<std::deque<std::unique_ptr<SpilledJob>>> jobs(spills.size());
+            {
+                std::lock_guard<std::mutex> lock(spill_mutex);
+                jobs.swap(spills);
+                spilled.store(0, std::memory_order_relaxed);
+            }
+            for (auto& lane: jobs) {
+                dropped = dropped || !lane.empty();
+            }
+            // Destroyed outside the lock, like drop_spilled's.
+            return dropped;
+        }
+
+        void shutdown() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cv.notify_one();
+            thread.join();
+        }
+
         void run() {
-            while (true) {
+            // Empty polls since the last job.
+            std::uint32_t idle = 0;
+            // Jobs still queued when the worker is stopped are dropped.
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (run_batch(max_job_batch)) {
+                    idle = 0;
+                    continue;
+                }
+
+                switch (options.wait) {
+                case WaitStrategy::BusySpin:
+                    cpu_relax();
+                    continue;
+                case WaitStrategy::SpinYield:
+                    if (idle < options.spins) {
+                        idle++;
+                        cpu_relax();
+                    } else {
+                        std::this_thread::yield();
+                    }
+                    continue;
+                case WaitStrategy::SpinPark:
+                    if (idle < options.spins) {
+                        idle++;
+                        cpu_relax();
+                        continue;
+                    }
+                    idle = 0;
+                    break;
+                case WaitStrategy::Park:
+                    break;
+                }
+
                 std::unique_lock<std::mutex> lock(mutex);
-                cv.wait(lock, [&]{return stop || !buffer.empty();});
+                sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                cv.wait(lock, [&]{return stop || !all_empty();});
+                sleeping.store(false, std::memory_order_relaxed);
 
                 if (stop) {
                     return;
                 }
+            }
+        }
+    };
 
-                auto job = std::move(buffer.front());
-                buffer.pop_front();
-                lock.unlock();
-                job->run();
+    // Where a job's result goes.
+    struct DiscardResult {
+        template<typename F>
+        void run(F&& f) {
+            try {
+                f();
+            } catch (...) {
+                // nobody to report to
             }
         }
+
+        void fail(std::exception_ptr) {}
     };
-}
 
-template<typename HandlerT>
-class Buffered {
-public:
-    Buffered(HandlerT handler, std::size_t max_queue_size=0): 
-        handler(std::move(handler)),
-        worker(std::make_unique<detail::Worker>(max_queue_size))
-        {}
+    template<typename T>
+    struct PromiseResult {
+        std::promise<T> promise;
 
-    template<typename CtxT, typename EventT, typename = std::enable_if_t<dispatch_match_v<HandlerT, CtxT&, EventT>>>
-    auto operator()(CtxT& ctx, EventT event) {
-        std::promise<std::decay_t<decltype(handler(ctx, std::move(event)))>> promise;
-        auto future = promise.get_future();
+        template<typename F>
+        void run(F&& f) {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    f();
+                    promise.set_value();
+                } else {
+                    promise.set_value(f());
+                }
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }
 
-        worker->add_job([this, &ctx, e=std::move(event), p=std::move(promise)] () mutable {
+        void fail(std::exception_ptr e) {promise.set_exception(std::move(e));}
+    };
+
+    template<typename T>
+    struct CompletionResult {
+        CompletionHandle<T> handle;
+
+        template<typename F>
+        void run(F&& f) {
             try {
-                if constexpr (std::is_void_v<decltype(handler(ctx, std::move(e)))>) {
-                    handler(ctx, std::move(e));
-                    p.set_value();
+                if constexpr (std::is_void_v<T>) {
+                    f();
+                    handle.set_value();
                 } else {
-                    p.set_value(handler(ctx, std::move(e)));
+                    handle.set_value(f());
                 }
             } catch (...) {
+                handle.set_exception(std::current_exception());
+            }
+        }
+
+        void fail(std::exception_ptr e) {handle.set_exception(std::move(e));}
+    };
+
+    struct NotAnEvent {};
+
+    // A handler takes batches of EventT if it can be called with a Span<const EventT>.
+    // Generic handlers that take anything at all are excluded, they would be handed
+    // the Span thinking it is an event.
+    template<typename HandlerT, typename CtxT, typename EventT>
+    constexpr bool is_batch_handler_v =
+        can_call<HandlerT&, CtxT&, Span<const EventT>>::value && !can_call<HandlerT&, CtxT&, NotAnEvent>::value;
+
+    template<bool Batch, typename HandlerT, typename CtxT, typename EventT>
+    struct BufferedResult {
+        using type = std::decay_t<decltype(std::declval<HandlerT&>()(std::declval<CtxT&>(), std::declval<EventT&&>()))>;
+    };
+
+    template<typename HandlerT, typename CtxT, typename EventT>
+    struct BufferedResult<true, HandlerT, CtxT, EventT> {
+        using type = void;
+    };
+
+    template<typename HandlerT, typename CtxT, typename EventT, typename ResultSinkT>
+    struct BufferedJob {
+        HandlerT* handler;
+        CtxT* ctx;
+        EventT event;
+        ResultSinkT result;
+
+        void operator()() {
+            if constexpr (batchable) {
+                result.run([&]{(*handler)(*ctx, Span<const EventT>(&event, 1));});
+            } else {
+                result.run([&]() -> decltype(auto) {return (*handler)(*ctx, std::move(event));});
+            }
+        }
+
+        static constexpr bool batchable = is_batch_handler_v<HandlerT, CtxT, EventT>;
+
+        // Moves the events of each run of jobs with the same ctx next to each other
+        // and hands them to the handler in one call.
+        static void run_batch(BufferedJob** jobs, std::size_t count) {
+            // Per thread and never shrunk, so a warmed up worker doesn't allocate here.
+            // One buffer per nesting level, the handler can end up running another batch
+            // of this type on the same thread, e.g. by helping an executor while it
+            // waits, and the outer batch's span has to stay put.
+            static thread_local std::deque<std::vector<EventT>> buffers;
+            static thread_local std::size_t depth = 0;
+            if (buffers.size() == depth) {
+                buffers.emplace_back();
+            }
+            std::vector<EventT>& events = buffers[depth];
+            struct Nest {
+                std::size_t& depth;
+                std::vector<EventT>& events;
+                ~Nest() {
+                    events.clear();
+                    depth--;
+                }
+            } nest{depth, events};
+            depth++;
+
+            for (std::size_t start = 0; start < count;) {
+                std::size_t end = start;
+                CtxT* ctx = jobs[start]->ctx;
+                for (; end < count && jobs[end]->ctx == ctx; end++) {
+                    events.push_back(std::move(jobs[end]->event));
+                }
+
                 try {
-                    p.set_exception(std::current_exception());
+                    (*jobs[start]->handler)(*ctx, Span<const EventT>(events.data(), events.size()));
+                    for (std::size_t i = start; i < end; i++) {
+                        jobs[i]->result.run([]{});
+                    }
                 } catch (...) {
-                    // do nothing
+                    for (std::size_t i = start; i < end; i++) {
+                        jobs[i]->result.fail(std::current_exception());
+                    }
                 }
+                events.clear();
+                start = end;
             }
-        });
+        }
+    };
+}
+
+// Runs the wrapped handler on a worker thread. The worker takes everything that is queued
+// in one go, and if the handler can be called with (Ctx&, Span<const EventT>) it is given
+// consecutive EventTs as one batch instead of one call per event, which lets handlers
+// amortise per call costs like writing to a file or GPU buffer.
+//
+// Pass single_producer if events will only ever be posted from one thread at a
+// time to use the cheaper SPSC queue. QueueLimits
+// bounds the queue by job count and/or bytes and picks what happens to events that
+// arrive when it is full, a plain max_queue_size drops the newest events. Given an
+// Executor (e.g. Executor::shared()) it runs on the executor's threads instead of
+// starting a thread of its own, the executor must outlive it. It can be destroyed from
+// one of the executor's tasks, but not from its own handler.
+//
+// Jobs are stored inline in a preallocated ring and the promise's shared state is
+// pooled, so once warmed up posting an event doesn't allocate unless the event is too
+// big to fit in the ring inline (see JobRing::max_inline_slots). post and submit skip
+// the promise altogether. Events that arrive while the ring is full are put on the heap
+// instead, the ring is at most 256KB and a bigger budget is made up on the heap. Without
+// a budget the queue is unbounded, so a handler can keep posting to its own Buffered.
+//
+// Given PriorityLanes the queue is split into lanes so urgent events, e.g. input, don't
+// wait behind a burst of background ones like logging. An event's lane is its
+// event_priority unless post, submit or async are given a Priority, and the queueing
+// delay of each lane is recorded for queue_delay.
+//
+// WorkerOptions pick the worker's WaitStrategy. By default it parks as soon as its queue
+// is empty and producers pay a futex wake for the next event. Spinning first keeps the
+// handoff to well under a microsecond while events keep coming, at the cost of a core.
+template<typename HandlerT, Producers P = Producers::Multi>
+class Buffered {
+public:
+    // Batch handlers (see below) are always void.
+    template<typename CtxT, typename EventT>
+    using result_t = typename detail::BufferedResult<detail::is_batch_handler_v<HandlerT, CtxT, EventT>, HandlerT, CtxT, EventT>::type;
+
+    template<typename CtxT, typename EventT>
+    static constexpr bool accepts_v = dispatch_match_v<HandlerT, CtxT&, EventT> || detail::is_batch_handler_v<HandlerT, CtxT, EventT>;
+
+    Buffered(HandlerT handler, std::size_t max_queue_size=0, producers_t<P> tag = {}):
+        Buffered(std::move(handler), QueueLimits{max_queue_size, 0, Overflow::DropNewest}, tag)
+        {}
+
+    Buffered(HandlerT handler, QueueLimits limits, producers_t<P> = {}):
+        handler(std::move(handler)),
+        worker(std::make_unique<detail::Worker<P>>(limits))
+        {}
+
+    // Runs the handler as a strand on executor instead of on a thread of its own.
+    // Events are still handled one at a time in the order they were queued.
+    Buffered(HandlerT handler, Executor& executor, producers_t<P> tag = {}):
+        Buffered(std::move(handler), QueueLimits{}, executor, tag)
+        {}
+
+    Buffered(HandlerT handler, QueueLimits limits, Executor& executor, producers_t<P> = {}):
+        handler(std::move(handler)),
+        worker(std::make_unique<detail::Worker<P>>(limits, &executor))
+        {}
+
+    Buffered(HandlerT handler, QueueLimits limits, PriorityLanes lanes, producers_t<P> = {}):
+        handler(std::move(handler)),
+        worker(std::make_unique<detail::Worker<P>>(limits, nullptr, std::move(lanes)))
+        {}
+
+    Buffered(HandlerT handler, QueueLimits limits, PriorityLanes lanes, Executor& executor, producers_t<P> = {}):
+        handler(std::move(handler)),
+        worker(std::make_unique<detail::Worker<P>>(limits, &executor, std::move(lanes)))
+        {}
+
+    // Picks how the worker thread waits for events, and optionally pins and names it.
+    // Throws std::system_error if the thread can't be pinned or named.
+    Buffered(HandlerT handler, QueueLimits limits, WorkerOptions options, producers_t<P> = {}):
+        handler(std::move(handler)),
+        worker(std::make_unique<detail::Worker<P>>(limits, nullptr, std::nullopt, std::move(options)))
+        {}
+
+    Buffered(HandlerT handler, QueueLimits limits, PriorityLanes lanes, WorkerOptions options, producers_t<P> = {}):
+        handler(std::move(handler)),
+        worker(std::make_unique<detail::Worker<P>>(limits, nullptr, std::move(lanes), std::move(options)))
+        {}
+
+    // Void handlers are fire and forget, there is nothing to wait for so no promise is made.
+    // Otherwise returns a std::future for the handler's result.
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    auto operator()(CtxT& ctx, EventT event) {
+        using ResultT = result_t<CtxT, EventT>;
+        if constexpr (std::is_void_v<ResultT>) {
+            post(ctx, std::move(event));
+        } else {
+            // The shared state comes from a pool so steady state posting doesn't allocate.
+            std::promise<ResultT> promise(std::allocator_arg, PoolAllocator<char>{});
+            auto future = promise.get_future();
+            enqueue(ctx, std::move(event), detail::PromiseResult<ResultT>{std::move(promise)});
+            return future;
+        }
+    }
+
+    // Runs the handler and throws away its result. Exceptions thrown by the handler are
+    // swallowed, use submit or operator() to see them. Returns false if the event was shed.
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    bool post(CtxT& ctx, EventT event, Priority priority = default_priority<EventT>()) {
+        return enqueue(ctx, std::move(event), detail::DiscardResult{}, priority);
+    }
+
+    // Like operator() but the result is delivered to completion instead of a std::future,
+    // completion must stay alive until it is ready.
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    void submit(CtxT& ctx, EventT event, Completion<result_t<CtxT, EventT>>& completion, Priority priority = default_priority<EventT>()) {
+        using ResultT = result_t<CtxT, EventT>;
+        enqueue(ctx, std::move(event), detail::CompletionResult<ResultT>{detail::CompletionHandle<ResultT>(completion)}, priority);
+    }
+
+    // Like operator() but returns a Future, which can be continued with then() instead of
+    // waited on, so chaining Buffered handlers doesn't need a thread blocked in between.
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    Future<result_t<CtxT, EventT>> async(CtxT& ctx, EventT event, Priority priority = default_priority<EventT>()) {
+        using ResultT = result_t<CtxT, EventT>;
+        auto* state = new detail::FutureState<ResultT>();
+        state->add_ref();
+        Future<ResultT> future(state);
+        enqueue(ctx, std::move(event), detail::FutureResult<ResultT>(state), priority);
         return future;
     }
+
+    QueueStats stats() const {return worker->stats();}
+
+    std::size_t lane_count() const {return worker->lane_count();}
+
+    // Time from queueing to the handler being called for the events of one lane, only
+    // recorded when constructed with PriorityLanes, which can be a single lane.
+    LatencyHistogram queue_delay(std::size_t lane) const {return worker->queue_delay(lane);}
+
 private:
+    template<typename EventT>
+    static constexpr Priority default_priority() {return Priority{event_priority<EventT>::value};}
+
+    template<typename CtxT, typename EventT, typename ResultSinkT>
+    bool enqueue(CtxT& ctx, EventT&& event, ResultSinkT result, Priority priority = default_priority<EventT>()) {
+        using JobT = detail::BufferedJob<HandlerT, CtxT, EventT, ResultSinkT>;
+        std::size_t owned = owned_bytes<EventT>::of(event);
+        if (!worker->template admit<JobT>(owned)) {
+            if (worker->queue_limits().overflow == Overflow::Reject) {
+                result.fail(std::make_exception_ptr(QueueFull{}));
+            }
+            // otherwise result is destroyed without being set which breaks the promise
+            return false;
+        }
+        worker->push(JobT{&handler, &ctx, std::move(event), std::move(result)}, owned, priority.value);
+        return true;
+    }
+
     HandlerT handler;
-    std::unique_ptr<detail::Worker> worker;
+    std::unique_ptr<detail::Worker<P>> worker;
 };
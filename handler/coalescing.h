@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "meta.h"
+#include "buffered.h"
+
+namespace detail {
+    // Key function that can't be called with anything, so every event is coalesced by type.
+    struct ByType {};
+
+    struct CoalescingTableBase {
+        virtual ~CoalescingTableBase() = default;
+        virtual std::size_t size() const = 0;
+    };
+
+    template<typename CtxT, typename EventT>
+    struct CoalescingSlot {
+        // Stays engaged once set so replacing a value can reuse whatever it owns.
+        std::optional<EventT> value;
+        CtxT* ctx = nullptr;
+        bool pending = false;
+
+        // Returns true if an older pending value was replaced.
+        bool set(CtxT& new_ctx, EventT&& event) {
+            if (value) {
+                *value = std::move(event);
+            } else {
+                value.emplace(std::move(event));
+            }
+            ctx = &new_ctx;
+            return std::exchange(pending, true);
+        }
+    };
+
+    template<typename CtxT, typename EventT, typename KeyT>
+    struct CoalescingTable: CoalescingTableBase {
+        // unordered_map never moves its elements, so queued jobs can point at slots.
+        // A slot is erased when its job runs, so only keys with an event pending are
+        // here however many keys come and go.
+        std::unordered_map<KeyT, CoalescingSlot<CtxT, EventT>> slots;
+
+        std::size_t size() const override {return slots.size();}
+    };
+
+    template<typename CtxT, typename EventT>
+    struct CoalescingTable<CtxT, EventT, void>: CoalescingTableBase {
+        CoalescingSlot<CtxT, EventT> slot;
+
+        std::size_t size() const override {return 1;}
+    };
+}
+
+// Runs the wrapped handler on a worker like Buffered, but for events that are snapshots of
+// some state where only the newest value matters. At most one event per type is pending,
+// an event arriving while an older one of the same type is still queued replaces it in
+// place, so a producer posting the same kind of event over and over costs no extra memory
+// and a slow handler only ever sees the freshest value. Given a key function events it
+// can be called with are coalesced per type and key instead, e.g. per entity id. The slot
+// of each type is kept and reused, the slot of a key only while the key has an event
+// pending, so memory follows the keys in flight rather than every key ever seen.
+//
+// The handler is called with the ctx the newest event was posted with. Results and
+// exceptions are discarded, as with Buffered::post. Given an Executor it runs as a
+// strand on the executor's threads.
+template<typename HandlerT, typename KeyFnT = detail::ByType>
+class Coalescing {
+public:
+    Coalescing(HandlerT handler, KeyFnT key_fn = {}):
+        handler(std::move(handler)),
+        key_fn(std::move(key_fn)),
+        coalesced_(0),
+        worker(std::make_unique<detail::Worker<Producers::Multi>>(QueueLimits{}))
+        {}
+
+    Coalescing(HandlerT handler, Executor& executor):
+        Coalescing(std::move(handler), KeyFnT{}, executor)
+        {}
+
+    Coalescing(HandlerT handler, KeyFnT key_fn, Executor& executor):
+        handler(std::move(handler)),
+        key_fn(std::move(key_fn)),
+        coalesced_(0),
+        worker(std::make_unique<detail::Worker<Producers::Multi>>(QueueLimits{}, &executor))
+        {}
+
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<dispatch_match_v<HandlerT, CtxT&, EventT>>>
+    void operator()(CtxT& ctx, EventT event) {
+        detail::CoalescingSlot<CtxT, EventT>* slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot = &find_slot<CtxT>(event);
+            if (slot->set(ctx, std::move(event))) {
+                coalesced_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        // Only the event that made the slot pending queues a job, so there is never
+        // more than one job per slot.
+        worker->push(Job<CtxT, EventT>{this, slot}, 0);
+    }
+
+    // Number of events that were replaced by a newer one before being handled.
+    std::uint64_t coalesced() const {return coalesced_.load(std::memory_order_relaxed);}
+
+    // Slots held, one per event type seen plus one per key with an event pending.
+    std::size_t slot_count() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t count = 0;
+        for (auto& [type, table]: tables) {
+            count += table->size();
+        }
+        return count;
+    }
+
+private:
+    template<typename CtxT, typename EventT>
+    struct Job {
+        Coalescing* self;
+        detail::CoalescingSlot<CtxT, EventT>* slot;
+
+        void operator()() {self->run(*slot);}
+    };
+
+    template<typename EventT>
+    static constexpr bool keyed_v = can_call<const KeyFnT&, const EventT&>::value;
+
+    template<typename EventT, bool Keyed = keyed_v<EventT>>
+    struct key_of {
+        using type = void;
+    };
+
+    template<typename EventT>
+    struct key_of<EventT, true> {
+        using type = std::decay_t<decltype(std::declval<const KeyFnT&>()(std::declval<const EventT&>()))>;
+    };
+
+    template<typename CtxT, typename EventT>
+    using table_t = detail::CoalescingTable<CtxT, EventT, typename key_of<EventT>::type>;
+
+    // Called with mutex held.
+    template<typename CtxT, typename EventT>
+    detail::CoalescingSlot<CtxT, EventT>& find_slot(const EventT& event) {
+        using TableT = table_t<CtxT, EventT>;
+        auto& table = tables[type_id_v<TableT>];
+        if (!table) {
+            table = std::make_unique<TableT>();
+        }
+        auto& typed = static_cast<TableT&>(*table);
+        if constexpr (keyed_v<EventT>) {
+            return typed.slots[key_fn(event)];
+        } else {
+            return typed.slot;
+        }
+    }
+
+    template<typename CtxT, typename EventT>
+    void run(detail::CoalescingSlot<CtxT, EventT>& slot) {
+        std::optional<EventT> event;
+        CtxT* ctx;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            event.emplace(std::move(*slot.value));
+            ctx = slot.ctx;
+            slot.pending = false;
+            if constexpr (keyed_v<EventT>) {
+                // The event has the slot's key. Nothing points at the slot once its job
+                // has run, the next event for the key makes a new one.
+                using TableT = table_t<CtxT, EventT>;
+                static_cast<TableT&>(*tables[type_id_v<TableT>]).slots.erase(key_fn(*event));
+            }
+        }
+        detail::DiscardResult{}.run([&]{handler(*ctx, std::move(*event));});
+    }
+
+    HandlerT handler;
+    KeyFnT key_fn;
+    mutable std::mutex mutex;
+    std::unordered_map<TypeId, std::unique_ptr<detail::CoalescingTableBase>> tables;
+    std::atomic<std::uint64_t> coalesced_;
+    // Last so the worker stops before anything its jobs use is destroyed.
+    std::unique_ptr<detail::Worker<Producers::Multi>> worker;
+};
+
+template<typename HandlerT>
+Coalescing(HandlerT) -> Coalescing<HandlerT>;
+
+template<typename HandlerT>
+Coalescing(HandlerT, Executor&) -> Coalescing<HandlerT>;
+
+template<typename HandlerT, typename KeyFnT>
+Coalescing(HandlerT, KeyFnT) -> Coalescing<HandlerT, KeyFnT>;
+
+template<typename HandlerT, typename KeyFnT>
+Coalescing(HandlerT, KeyFnT, Executor&) -> Coalescing<HandlerT, KeyFnT>;
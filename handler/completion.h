@@ -0,0 +1,217 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+namespace detail {
+    template<typename T>
+    class CompletionHandle;
+
+    // void results only need room for an exception.
+    struct NoValue {};
+
+    template<typename T>
+    using completion_value_t = std::conditional_t<std::is_void_v<T>, NoValue, T>;
+
+    // Spins, then yields, then sleeps with a growing backoff until done() is true.
+    template<typename F>
+    void backoff_wait(F done) {
+        int spins = 0;
+        auto backoff = std::chrono::microseconds(1);
+        while (!done()) {
+            if (spins < 64) {
+                spins++;
+            } else if (spins < 128) {
+                spins++;
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(backoff);
+                if (backoff < std::chrono::microseconds(500)) {
+                    backoff *= 2;
+                }
+            }
+        }
+    }
+}
+
+// A cheaper alternative to std::promise/std::future for a single result. The result
+// lives inline in the Completion and the only synchronisation is one atomic state word,
+// so there's no shared state to allocate. The caller owns the Completion and must keep
+// it alive (and at the same address) until the result has been set, the destructor
+// waits for a pending result for that reason. Once the result has been taken with get
+// the Completion can be reused.
+//
+// Waiting spins, then yields, then sleeps with a growing backoff, it is meant for results
+// that are expected soon. Use std::future for long waits.
+template<typename T>
+class Completion {
+public:
+    Completion() = default;
+
+    ~Completion() {
+        wait();
+        reset();
+    }
+
+    Completion(const Completion&) = delete;
+    Completion(Completion&&) = delete;
+
+    Completion& operator=(const Completion&) = delete;
+    Completion& operator=(Completion&&) = delete;
+
+    bool ready() const {
+        auto s = state.load(std::memory_order_acquire);
+        return s == HasValue || s == HasError;
+    }
+
+    bool pending() const {
+        return state.load(std::memory_order_acquire) == Pending;
+    }
+
+    void wait() const {
+        detail::backoff_wait([this]{return !pending();});
+    }
+
+    // Has fn(arg) called on the producing thread as soon as the result is set, for waiting
+    // without a blocked thread (e.g. resuming a coroutine, see coro.h). It must be set
+    // before the Completion is handed to a producer, fn may destroy the Completion.
+    void on_ready(void (*fn)(void*), void* arg) {
+        ready_fn = fn;
+        ready_arg = arg;
+    }
+
+    // Waits for the result and then moves it out, or rethrows the handler's exception.
+    T get() {
+        wait();
+        if (state.load(std::memory_order_acquire) == HasError) {
+            std::exception_ptr e = std::move(*error());
+            reset();
+            std::rethrow_exception(std::move(e));
+        }
+        if (state.load(std::memory_order_relaxed) != HasValue) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+
+        if constexpr (std::is_void_v<T>) {
+            reset();
+        } else {
+            struct Reset {
+                Completion& c;
+                ~Reset() {c.reset();}
+            } guard{*this};
+            return std::move(*value());
+        }
+    }
+
+private:
+    template<typename U>
+    friend class detail::CompletionHandle;
+
+    using ValueT = detail::completion_value_t<T>;
+
+    enum State: std::uint32_t {
+        Empty,
+        Pending,
+        HasValue,
+        HasError,
+    };
+
+    std::atomic<std::uint32_t> state{Empty};
+    void (*ready_fn)(void*) = nullptr;
+    void* ready_arg = nullptr;
+    alignas(ValueT) alignas(std::exception_ptr) unsigned char storage[
+        sizeof(ValueT) > sizeof(std::exception_ptr) ? sizeof(ValueT) : sizeof(std::exception_ptr)
+    ];
+
+    ValueT* value() {return std::launder(reinterpret_cast<ValueT*>(storage));}
+    std::exception_ptr* error() {return std::launder(reinterpret_cast<std::exception_ptr*>(storage));}
+
+    // Only called by the owner once the result has been published.
+    void reset() {
+        auto s = state.load(std::memory_order_acquire);
+        if (s == HasValue) {
+            value()->~ValueT();
+        } else if (s == HasError) {
+            error()->~exception_ptr();
+        }
+        state.store(Empty, std::memory_order_relaxed);
+        ready_fn = nullptr;
+    }
+
+    void start() {
+        if (state.load(std::memory_order_relaxed) != Empty) {
+            throw std::future_error(std::future_errc::promise_already_satisfied);
+        }
+        state.store(Pending, std::memory_order_relaxed);
+    }
+
+    template<typename...Args>
+    void set_value(Args&&...args) {
+        new (storage) ValueT(std::forward<Args>(args)...);
+        publish(HasValue);
+    }
+
+    void set_exception(std::exception_ptr e) {
+        new (storage) std::exception_ptr(std::move(e));
+        publish(HasError);
+    }
+
+    void publish(State s) {
+        // The owner may destroy the Completion as soon as it sees the new state.
+        auto fn = ready_fn;
+        auto arg = ready_arg;
+        state.store(s, std::memory_order_release);
+        if (fn) {
+            fn(arg);
+        }
+    }
+};
+
+namespace detail {
+    // The producing side of a Completion, what std::promise is to std::future. If it is
+    // destroyed without setting a result the Completion gets a broken_promise error, the
+    // same as std::promise, so a dropped job never leaves its caller waiting forever.
+    template<typename T>
+    class CompletionHandle {
+    public:
+        explicit CompletionHandle(Completion<T>& completion): completion(&completion) {
+            completion.start();
+        }
+
+        CompletionHandle(CompletionHandle&& other): completion(std::exchange(other.completion, nullptr)) {}
+        CompletionHandle& operator=(CompletionHandle&&) = delete;
+
+        CompletionHandle(const CompletionHandle&) = delete;
+        CompletionHandle& operator=(const CompletionHandle&) = delete;
+
+        ~CompletionHandle() {
+            if (completion) {
+                std::exchange(completion, nullptr)->set_exception(
+                    std::make_exception_ptr(std::future_error(std::future_errc::broken_promise))
+                );
+            }
+        }
+
+        template<typename...Args>
+        void set_value(Args&&...args) {
+            // if constructing the value throws we still own the completion and
+            // the exception can be set instead.
+            completion->set_value(std::forward<Args>(args)...);
+            completion = nullptr;
+        }
+
+        void set_exception(std::exception_ptr e) {
+            std::exchange(completion, nullptr)->set_exception(std::move(e));
+        }
+
+    private:
+        Completion<T>* completion;
+    };
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+// C++20 only, the rest of the library is C++17.
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "batching.h"
+#include "buffered.h"
+#include "completion.h"
+#include "executor.h"
+
+template<typename T>
+class Async;
+
+namespace detail {
+    template<typename T>
+    struct AsyncPromiseBase {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+
+        std::suspend_always initial_suspend() noexcept {return {};}
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept {return false;}
+
+            // Symmetric transfer, resuming the awaiting coroutine doesn't grow the stack.
+            template<typename PromiseT>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<PromiseT> handle) noexcept {
+                if (auto continuation = handle.promise().continuation) {
+                    return continuation;
+                }
+                return std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept {return {};}
+
+        void unhandled_exception() {error = std::current_exception();}
+    };
+
+    template<typename T>
+    struct AsyncPromise: AsyncPromiseBase<T> {
+        std::optional<T> value;
+
+        Async<T> get_return_object();
+
+        template<typename U>
+        void return_value(U&& u) {value.emplace(std::forward<U>(u));}
+
+        T result() {
+            if (this->error) {
+                std::rethrow_exception(this->error);
+            }
+            return std::move(*value);
+        }
+    };
+
+    template<>
+    struct AsyncPromise<void>: AsyncPromiseBase<void> {
+        Async<void> get_return_object();
+
+        void return_void() {}
+
+        void result() {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    };
+
+    // Coroutine that starts straight away and frees itself when done, used to start an
+    // Async from code that isn't a coroutine.
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() {return {};}
+            std::suspend_never initial_suspend() noexcept {return {};}
+            std::suspend_never final_suspend() noexcept {return {};}
+            void return_void() {}
+            // nobody to report to, same as Buffered::post
+            void unhandled_exception() {}
+        };
+    };
+
+    template<typename T>
+    struct is_async: std::false_type {};
+
+    template<typename T>
+    struct is_async<Async<T>>: std::true_type {};
+
+    template<typename T>
+    struct async_value {
+        using type = T;
+    };
+
+    template<typename T>
+    struct async_value<Async<T>> {
+        using type = T;
+    };
+
+    template<typename T>
+    using async_value_t = typename async_value<T>::type;
+}
+
+// A lazily started coroutine producing a T. It starts when it is co_awaited and resumes
+// its awaiter when it finishes, without holding a thread while it is suspended. Use
+// spawn or sync_wait to start one from outside a coroutine.
+template<typename T = void>
+class [[nodiscard]] Async {
+public:
+    using promise_type = detail::AsyncPromise<T>;
+
+    explicit Async(std::coroutine_handle<promise_type> handle): handle(handle) {}
+
+    Async(Async&& other) noexcept: handle(std::exchange(other.handle, {})) {}
+    Async& operator=(Async&&) = delete;
+
+    Async(const Async&) = delete;
+    Async& operator=(const Async&) = delete;
+
+    ~Async() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {return false;}
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+
+    T await_resume() {return handle.promise().result();}
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+    template<typename T>
+    Async<T> AsyncPromise<T>::get_return_object() {
+        return Async<T>(std::coroutine_handle<AsyncPromise<T>>::from_promise(*this));
+    }
+
+    inline Async<void> AsyncPromise<void>::get_return_object() {
+        return Async<void>(std::coroutine_handle<AsyncPromise<void>>::from_promise(*this));
+    }
+
+    // Resumes the awaiting coroutine from whatever runs the scheduler's tasks. The awaiter
+    // lives in the coroutine frame so scheduling doesn't allocate.
+    template<typename SchedulerT>
+    struct ScheduleAwaiter: Task {
+        ScheduleAwaiter(SchedulerT& scheduler): Task{&ScheduleAwaiter::resume}, scheduler(&scheduler) {}
+
+        SchedulerT* scheduler;
+        std::coroutine_handle<> handle;
+
+        bool await_ready() noexcept {return false;}
+
+        void await_suspend(std::coroutine_handle<> awaiter) {
+            handle = awaiter;
+            scheduler->schedule(*this);
+        }
+
+        void await_resume() noexcept {}
+
+        static void resume(Task& task) {
+            static_cast<ScheduleAwaiter&>(task).handle.resume();
+        }
+    };
+
+    template<typename T>
+    struct CompletionAwaiter {
+        Completion<T> completion;
+
+        static void resume(void* handle) {
+            std::coroutine_handle<>::from_address(handle).resume();
+        }
+
+        T await_resume() {return completion.get();}
+    };
+}
+
+// co_await schedule_on(scheduler) moves the rest of the coroutine onto scheduler, an
+// Executor (the worker pool) or a LoopScheduler (the main loop).
+template<typename SchedulerT>
+detail::ScheduleAwaiter<SchedulerT> schedule_on(SchedulerT& scheduler) {
+    return {scheduler};
+}
+
+// Starts a coroutine without waiting for it. Its result and exceptions are discarded.
+inline void spawn(Async<void> async) {
+    [](Async<void> async) -> detail::Detached {
+        co_await std::move(async);
+    }(std::move(async));
+}
+
+// Starts a coroutine and blocks the calling thread until it is done.
+template<typename T>
+T sync_wait(Async<T> async) {
+    Completion<T> done;
+    [](Async<T> async, detail::CompletionHandle<T> handle) -> detail::Detached {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                co_await std::move(async);
+                handle.set_value();
+            } else {
+                handle.set_value(co_await std::move(async));
+            }
+        } catch (...) {
+            handle.set_exception(std::current_exception());
+        }
+    }(std::move(async), detail::CompletionHandle<T>(done));
+    return done.get();
+}
+
+namespace detail {
+    // Hands a request to TargetT::submit when the coroutine suspends, the coroutine is
+    // resumed by whatever thread completes it.
+    template<typename TargetT, typename CtxT, typename EventT, typename ResultT>
+    struct SubmitAwaiter: CompletionAwaiter<ResultT> {
+        TargetT& target;
+        CtxT& ctx;
+        EventT event;
+
+        SubmitAwaiter(TargetT& target, CtxT& ctx, EventT event): target(target), ctx(ctx), event(std::move(event)) {}
+
+        bool await_ready() noexcept {return false;}
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            this->completion.on_ready(&CompletionAwaiter<ResultT>::resume, handle.address());
+            // The coroutine may already be running again on the worker when submit
+            // returns, nothing here may be touched after it.
+            target.submit(ctx, std::move(event), this->completion);
+        }
+    };
+}
+
+// Awaitable version of Buffered::submit. The coroutine is resumed on the Buffered's worker
+// once the handler is done, co_await schedule_on(...) to move somewhere else afterwards.
+template<typename HandlerT, Producers P, typename CtxT, typename EventT>
+auto submit_async(Buffered<HandlerT, P>& buffered, CtxT& ctx, EventT event) {
+    using ResultT = typename Buffered<HandlerT, P>::template result_t<CtxT, EventT>;
+    return detail::SubmitAwaiter<Buffered<HandlerT, P>, CtxT, EventT, ResultT>(buffered, ctx, std::move(event));
+}
+
+// Awaitable version of Batching::submit, resumed on the Batching's thread once the
+// request's batch is done.
+template<typename HandlerT, typename CtxT, typename RequestT>
+auto submit_async(Batching<HandlerT>& batching, CtxT& ctx, RequestT request) {
+    using ResultT = typename Batching<HandlerT>::template result_t<CtxT, RequestT>;
+    return detail::SubmitAwaiter<Batching<HandlerT>, CtxT, RequestT, ResultT>(batching, ctx, std::move(request));
+}
+
+// Asks ctx for an answer to request without blocking, for a Ctx whose request handlers may
+// be coroutines. Handlers returning an Async are awaited, plain handlers are called
+// directly. The request is taken by value so it outlives any suspension.
+template<typename CtxT, typename RequestT>
+auto handle_request_async(CtxT& ctx, RequestT request)
+    -> Async<detail::async_value_t<decltype(ctx.handle_request(std::move(request)))>>
+{
+    using ResultT = decltype(ctx.handle_request(std::move(request)));
+    if constexpr (detail::is_async<ResultT>::value) {
+        co_return co_await ctx.handle_request(std::move(request));
+    } else if constexpr (std::is_void_v<ResultT>) {
+        ctx.handle_request(std::move(request));
+        co_return;
+    } else {
+        co_return ctx.handle_request(std::move(request));
+    }
+}
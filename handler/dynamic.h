@@ -2,8 +2,15 @@
 
 #include <type_traits>
 #include <vector>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
 
 #include "meta.h"
+#include "epoch.h"
 
 template<typename HandlerT>
 class Dynamic {
@@ -27,3 +34,122 @@ public:
 private:
     std::vector<HandlerT> handlers;
 };
+
+// Like Dynamic but handlers can be of any type and are registered for specific event types
+// at runtime. Each event type has its own flat table of handlers, found by the event's
+// type_id_v, so dispatching an event only touches the handlers registered for it.
+// Every handler gets a const EventT&, there is no last handler to move the event into.
+//
+// Handlers can be added and removed from any thread while others dispatch. The tables are
+// an immutable snapshot, dispatch reads the current one without locking or waiting, and
+// add/remove publish a modified copy. Old snapshots are freed through epoch based
+// reclamation (see detail::EpochDomain) once no dispatch is still using them, so a removed
+// handler may still be called by dispatches that started before remove returned.
+//
+// CtxT has to be fixed up front since handlers are type erased.
+template<typename CtxT>
+class DynamicAny {
+public:
+    using Id = std::uint64_t;
+
+    DynamicAny(): snapshot(new Snapshot) {}
+
+    // Nothing may be dispatching any more.
+    ~DynamicAny() {
+        delete snapshot.load(std::memory_order_relaxed);
+    }
+
+    DynamicAny(const DynamicAny&) = delete;
+    DynamicAny& operator=(const DynamicAny&) = delete;
+
+    // Registers handler for each of EventTs, it is called as handler(ctx, const EventT&).
+    // Returns an id to remove it with.
+    template<typename...EventTs, typename HandlerT>
+    Id add(HandlerT handler) {
+        static_assert(sizeof...(EventTs) > 0, "add needs at least one event type");
+        std::shared_ptr<HandlerT> shared = std::make_shared<HandlerT>(std::move(handler));
+
+        Id id;
+        Snapshot* old;
+        {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            id = next_id++;
+            auto* next = new Snapshot(*snapshot.load(std::memory_order_relaxed));
+            (next->tables[type_id_v<EventTs>].push_back(Entry{id, &call<HandlerT, EventTs>, shared}), ...);
+            old = snapshot.exchange(next, std::memory_order_seq_cst);
+        }
+        retire(old);
+        return id;
+    }
+
+    // Returns false if there is no handler with that id.
+    bool remove(Id id) {
+        Snapshot* old;
+        {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            auto* next = new Snapshot(*snapshot.load(std::memory_order_relaxed));
+            bool found = false;
+            for (auto& [type, entries]: next->tables) {
+                auto it = std::remove_if(entries.begin(), entries.end(), [id](const Entry& e){return e.id == id;});
+                found = found || it != entries.end();
+                entries.erase(it, entries.end());
+            }
+            if (!found) {
+                delete next;
+                return false;
+            }
+            old = snapshot.exchange(next, std::memory_order_seq_cst);
+        }
+        retire(old);
+        return true;
+    }
+
+    template<typename EventT>
+    std::size_t handler_count() const {
+        detail::EpochDomain::Guard guard;
+        const auto& tables = snapshot.load(std::memory_order_seq_cst)->tables;
+        auto it = tables.find(type_id_v<EventT>);
+        return it == tables.end() ? 0 : it->second.size();
+    }
+
+    template<typename EventT>
+    void operator()(CtxT& ctx, const EventT& event) {
+        detail::EpochDomain::Guard guard;
+        const auto& tables = snapshot.load(std::memory_order_seq_cst)->tables;
+        auto it = tables.find(type_id_v<EventT>);
+        if (it == tables.end()) {
+            return;
+        }
+        for (auto& entry: it->second) {
+            entry.call(entry.handler.get(), ctx, &event);
+        }
+    }
+
+private:
+    struct Entry {
+        Id id;
+        void (*call)(void* handler, CtxT& ctx, const void* event);
+        // Shared between the tables of every event type the handler was added for,
+        // and between snapshots.
+        std::shared_ptr<void> handler;
+    };
+
+    struct Snapshot {
+        std::unordered_map<TypeId, std::vector<Entry>> tables;
+    };
+
+    template<typename HandlerT, typename EventT>
+    static void call(void* handler, CtxT& ctx, const void* event) {
+        (*static_cast<HandlerT*>(handler))(ctx, *static_cast<const EventT*>(event));
+    }
+
+    // Not under write_mutex, freeing old snapshots can run handler destructors and
+    // those may well add or remove handlers.
+    static void retire(Snapshot* old) {
+        detail::EpochDomain::global().retire(old);
+    }
+
+    std::atomic<Snapshot*> snapshot;
+    std::mutex write_mutex;
+    Id next_id = 1;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+namespace detail {
+    // Epoch based reclamation for read mostly data that is replaced rather than modified
+    // (read-copy-update). Readers hold a Guard while they use a snapshot, which costs a
+    // couple of stores and never waits. Writers swap in a new snapshot and retire the old
+    // one, it is deleted once no reader that could still be looking at it is left.
+    //
+    // There is one process wide domain, it is never destroyed.
+    class EpochDomain {
+    public:
+        struct Record {
+            // Global epoch when the thread entered, 0 when it isn't reading.
+            std::atomic<std::uint64_t> epoch{0};
+            // Only touched by the owning thread, so guards can nest.
+            unsigned nesting = 0;
+            std::atomic<bool> in_use{true};
+            Record* next = nullptr;
+        };
+
+        class Guard {
+        public:
+            Guard(): Guard(global()) {}
+
+            explicit Guard(EpochDomain& domain): record(domain.local_record()) {
+                if (record->nesting++ == 0) {
+                    // seq_cst so a writer either sees us or we see its new snapshot.
+                    record->epoch.store(domain.epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+                }
+            }
+
+            ~Guard() {
+                if (--record->nesting == 0) {
+                    record->epoch.store(0, std::memory_order_release);
+                }
+            }
+
+            Guard(const Guard&) = delete;
+            Guard& operator=(const Guard&) = delete;
+
+        private:
+            Record* record;
+        };
+
+        static EpochDomain& global() {
+            static EpochDomain* domain = new EpochDomain;
+            return *domain;
+        }
+
+        // p must already be unreachable for new readers.
+        template<typename T>
+        void retire(T* p) {
+            retire(p, [](void* p){delete static_cast<T*>(p);});
+        }
+
+        void retire(void* p, void (*deleter)(void*)) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                retired.push_back(Retired{epoch.fetch_add(1, std::memory_order_seq_cst), p, deleter});
+            }
+            reclaim();
+        }
+
+        // Deletes whatever retired snapshots no reader can still see, returns how many.
+        std::size_t reclaim() {
+            std::vector<Retired> ready;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::uint64_t oldest = oldest_reader();
+                auto it = std::partition(retired.begin(), retired.end(), [&](const Retired& r){return r.epoch >= oldest;});
+                ready.assign(it, retired.end());
+                retired.erase(it, retired.end());
+            }
+            // Outside the lock, deleters may well retire something themselves.
+            for (auto& r: ready) {
+                r.deleter(r.p);
+            }
+            return ready.size();
+        }
+
+        std::size_t retired_count() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return retired.size();
+        }
+
+    private:
+        struct Retired {
+            std::uint64_t epoch;
+            void* p;
+            void (*deleter)(void*);
+        };
+
+        // Gives each thread a record for as long as it lives, then lets another thread have it.
+        struct LocalRecord {
+            Record* record;
+            explicit LocalRecord(EpochDomain& domain): record(domain.acquire_record()) {}
+            ~LocalRecord() {record->in_use.store(false, std::memory_order_release);}
+        };
+
+        EpochDomain() = default;
+
+        std::atomic<std::uint64_t> epoch{1};
+        std::atomic<Record*> records{nullptr};
+        std::mutex mutex;
+        std::vector<Retired> retired;
+
+        Record* local_record() {
+            static thread_local LocalRecord local(*this);
+            return local.record;
+        }
+
+        Record* acquire_record() {
+            for (Record* r = records.load(std::memory_order_acquire); r; r = r->next) {
+                bool expected = false;
+                if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(expected, true)) {
+                    return r;
+                }
+            }
+            // Records are never freed, the list only grows to the most threads alive at once.
+            Record* r = new Record;
+            r->next = records.load(std::memory_order_relaxed);
+            while (!records.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed)) {}
+            return r;
+        }
+
+        std::uint64_t oldest_reader() const {
+            std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+            for (Record* r = records.load(std::memory_order_acquire); r; r = r->next) {
+                std::uint64_t e = r->epoch.load(std::memory_order_seq_cst);
+                if (e != 0) {
+                    oldest = std::min(oldest, e);
+                }
+            }
+            return oldest;
+        }
+    };
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+namespace detail {
+    // Something an Executor can run. Tasks are intrusive, the executor only ever
+    // stores pointers to them so scheduling a task never allocates. A task must not
+    // be scheduled again until it has started running.
+    struct Task {
+        void (*run)(Task&);
+    };
+
+    // FIFO of task pointers backed by a power of two ring that grows when full
+    // and never shrinks, so a warmed up queue doesn't allocate.
+    class TaskQueue {
+    public:
+        TaskQueue(): tasks(16), head(0), count(0) {}
+
+        void push(Task* task) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (count == tasks.size()) {
+                grow();
+            }
+            tasks[(head + count) & (tasks.size() - 1)] = task;
+            count++;
+            size_hint.store(count, std::memory_order_relaxed);
+        }
+
+        // The owner takes the oldest task.
+        Task* pop() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (count == 0) {
+                return nullptr;
+            }
+            Task* task = tasks[head];
+            head = (head + 1) & (tasks.size() - 1);
+            count--;
+            size_hint.store(count, std::memory_order_relaxed);
+            return task;
+        }
+
+        // Thieves take the newest task, it is the one the owner would get to last.
+        Task* steal() {
+            if (size_hint.load(std::memory_order_relaxed) == 0) {
+                return nullptr;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (count == 0) {
+                return nullptr;
+            }
+            count--;
+            size_hint.store(count, std::memory_order_relaxed);
+            return tasks[(head + count) & (tasks.size() - 1)];
+        }
+
+        // Takes task out if it's still queued, searching from the newest.
+        bool remove(Task* task) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (std::size_t i = count; i-- > 0;) {
+                if (tasks[(head + i) & (tasks.size() - 1)] != task) {
+                    continue;
+                }
+                for (; i + 1 < count; i++) {
+                    tasks[(head + i) & (tasks.size() - 1)] = tasks[(head + i + 1) & (tasks.size() - 1)];
+                }
+                count--;
+                size_hint.store(count, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        bool empty() const {
+            return size_hint.load(std::memory_order_relaxed) == 0;
+        }
+
+    private:
+        std::mutex mutex;
+        std::vector<Task*> tasks;
+        std::size_t head;
+        std::size_t count;
+        std::atomic<std::size_t> size_hint{0};
+
+        void grow() {
+            std::vector<Task*> bigger(tasks.size() * 2);
+            for (std::size_t i = 0; i < count; i++) {
+                bigger[i] = tasks[(head + i) & (tasks.size() - 1)];
+            }
+            tasks = std::move(bigger);
+            head = 0;
+        }
+    };
+}
+
+// A fixed size pool of threads that run detail::Tasks. Each thread has its own queue,
+// tasks scheduled from a pool thread go on that thread's queue and tasks scheduled from
+// anywhere else go on a shared queue. Idle threads steal from the other threads' queues
+// before going to sleep.
+//
+// Buffered uses this through strands, see Buffered's Executor& constructors. The executor
+// must outlive every Buffered that runs on it.
+class Executor {
+public:
+    explicit Executor(std::size_t thread_count = default_thread_count()):
+        queues(thread_count ? thread_count : 1),
+        sleepers(0),
+        queued(0),
+        stop(false)
+    {
+        threads.reserve(queues.size());
+        for (std::size_t i = 0; i < queues.size(); i++) {
+            threads.emplace_back([this, i]{run(i);});
+        }
+    }
+
+    // Tasks still queued are not run.
+    ~Executor() {
+        {
+            std::lock_guard<std::mutex> lock(park_mutex);
+            stop = true;
+        }
+        park_cv.notify_all();
+        for (auto& thread: threads) {
+            thread.join();
+        }
+    }
+
+    Executor(const Executor&) = delete;
+    Executor(Executor&&) = delete;
+
+    Executor& operator=(const Executor&) = delete;
+    Executor& operator=(Executor&&) = delete;
+
+    void schedule(detail::Task& task) {
+        if (current_executor == this) {
+            queues[current_index].push(&task);
+        } else {
+            injected.push(&task);
+        }
+
+        queued.fetch_add(1, std::memory_order_relaxed);
+        // Pairs with the fence in park, either we see the sleeper or it sees the task.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed)) {
+            { std::lock_guard<std::mutex> lock(park_mutex); }
+            park_cv.notify_one();
+        }
+    }
+
+    // Takes task back if no thread has started it yet, so the caller can run it itself.
+    // Must be called from the thread that scheduled it.
+    bool try_unschedule(detail::Task& task) {
+        auto& queue = current_executor == this ? queues[current_index] : injected;
+        if (!queue.remove(&task)) {
+            return false;
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Runs one queued task on the calling thread, returns false if there was none. The
+    // task can be anyone's, e.g. another Buffered's strand, so this is for the executor's
+    // own threads waiting on something that may be queued behind them.
+    bool try_run_one() {
+        detail::Task* task = nullptr;
+        if (current_executor == this) {
+            task = find_task(current_index);
+        } else {
+            task = injected.pop();
+            for (std::size_t i = 0; !task && i < queues.size(); i++) {
+                task = queues[i].steal();
+            }
+        }
+        if (!task) {
+            return false;
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        task->run(*task);
+        return true;
+    }
+
+    std::size_t size() const {return threads.size();}
+
+    // True on the executor's own threads.
+    bool is_current() const {return current_executor == this;}
+
+    static std::size_t default_thread_count() {
+        std::size_t n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+    // Process wide executor with one thread per core. It is never destroyed so
+    // handlers using it can live in statics.
+    static Executor& shared() {
+        static Executor* executor = new Executor();
+        return *executor;
+    }
+
+private:
+    std::vector<detail::TaskQueue> queues;
+    detail::TaskQueue injected;
+    std::vector<std::thread> threads;
+    std::mutex park_mutex;
+    std::condition_variable park_cv;
+    std::atomic<std::size_t> sleepers;
+    std::atomic<std::size_t> queued;
+    bool stop;
+
+    static inline thread_local Executor* current_executor = nullptr;
+    static inline thread_local std::size_t current_index = 0;
+
+    detail::Task* find_task(std::size_t index) {
+        if (detail::Task* task = queues[index].pop()) {
+            return task;
+        }
+        if (detail::Task* task = injected.pop()) {
+            return task;
+        }
+        for (std::size_t i = 1; i < queues.size(); i++) {
+            if (detail::Task* task = queues[(index + i) % queues.size()].steal()) {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    void run(std::size_t index) {
+        current_executor = this;
+        current_index = index;
+        while (true) {
+            if (detail::Task* task = find_task(index)) {
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                task->run(*task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(park_mutex);
+            sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            park_cv.wait(lock, [&]{return stop || queued.load(std::memory_order_relaxed) > 0;});
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+            if (stop) {
+                return;
+            }
+        }
+    }
+};
+
+// Runs detail::Tasks on the thread that calls run_pending, typically once per frame from the
+// main loop. Anything that takes an Executor to say where to run (coroutines, Future
+// continuations) can take a LoopScheduler instead. Scheduling from any thread is safe.
+class LoopScheduler {
+public:
+    void schedule(detail::Task& task) {tasks.push(&task);}
+
+    // Runs at most max_tasks tasks, so tasks that keep rescheduling themselves can't
+    // keep the loop here forever. Returns how many ran.
+    std::size_t run_pending(std::size_t max_tasks = 1024) {
+        std::size_t ran = 0;
+        for (; ran < max_tasks; ran++) {
+            detail::Task* task = tasks.pop();
+            if (!task) {
+                break;
+            }
+            task->run(*task);
+        }
+        return ran;
+    }
+
+private:
+    detail::TaskQueue tasks;
+};
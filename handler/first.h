@@ -127,15 +127,15 @@ namespace detail {
         auto wrapper = (
             FirstResultWrapper<void>{} 
             << ... <<
-            FirstHandlerClosure<std::tuple_element_t<HeadIs, HandlerTup>, CtxT, RequestT>{
-                std::get<HeadIs>(handlers),
+            FirstHandlerClosure<handler_element_t<HeadIs, HandlerTup>, CtxT, RequestT>{
+                get_handler<HeadIs>(handlers),
                 ctx,
                 std::forward<RequestT>(request)
             }
         );
 
-        return (wrapper << FirstLastHandlerClosure<std::tuple_element_t<LastI, HandlerTup>, CtxT, RequestT>{
-            std::get<LastI>(handlers),
+        return (wrapper << FirstLastHandlerClosure<handler_element_t<LastI, HandlerTup>, CtxT, RequestT>{
+            get_handler<LastI>(handlers),
             ctx,
             std::forward<RequestT>(request)
         }).get();
@@ -146,7 +146,7 @@ namespace detail {
 template<typename ...HandlerTs>
 class First {
 public:
-    First(HandlerTs...handlers): handlers(handlers...) {}
+    First(HandlerTs...handlers): handlers(std::move(handlers)...) {}
 
     // Search for a handler based on remove_cvref_t<RequestT> because basing dispatch on just the type of request
     // seems like the easiest thing to work with
@@ -160,5 +160,5 @@ public:
     template<typename CtxT>
     void operator() (CtxT&, NoRequestHandlerError) = delete;
 private:
-    std::tuple<HandlerTs...> handlers;
+    HandlerTuple<HandlerTs...> handlers;
 };
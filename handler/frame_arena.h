@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "span.h"
+
+class FrameArena;
+
+// Thrown when a handle into a FrameArena is used after the frame it was made in ended.
+class StaleFrameRef: public std::logic_error {
+public:
+    StaleFrameRef(): std::logic_error("frame arena handle used after its frame ended") {}
+};
+
+namespace detail {
+    // What every FrameArena handle holds, the arena and the frame it was allocated in.
+    struct FrameStamp {
+        const FrameArena* arena = nullptr;
+        std::uint64_t frame = 0;
+
+        // Throws StaleFrameRef unless the frame is still running. Arena thread only.
+        void check() const;
+
+        // Calls copy while the frame can't end, from any thread.
+        template<typename F>
+        std::invoke_result_t<F&> pinned(F&& copy) const;
+    };
+}
+
+// A T allocated in a FrameArena. Copying the handle doesn't copy the T, so events made
+// of handles fit inline in a Buffered's ring and posting them doesn't allocate.
+//
+// get and operator* are for the arena's own thread, during the frame. A handler that
+// can run after the frame ended, e.g. in a Buffered, takes its own copy with copy_out,
+// which is safe from any thread and throws StaleFrameRef if it was too late.
+template<typename T>
+class FrameRef {
+public:
+    FrameRef() = default;
+
+    const T& get() const {
+        stamp.check();
+        return *value;
+    }
+
+    const T& operator*() const {return get();}
+    const T* operator->() const {return &get();}
+
+    T copy_out() const {
+        return stamp.pinned([&]{return T(*value);});
+    }
+
+private:
+    friend class FrameArena;
+
+    FrameRef(detail::FrameStamp stamp, const T* value): stamp(stamp), value(value) {}
+
+    detail::FrameStamp stamp;
+    const T* value = nullptr;
+};
+
+// An array of T allocated in a FrameArena, with the same rules as FrameRef.
+template<typename T>
+class FrameSpan {
+public:
+    FrameSpan() = default;
+
+    Span<const T> get() const {
+        stamp.check();
+        return Span<const T>(data, count);
+    }
+
+    std::size_t size() const {return count;}
+
+    std::vector<T> copy_out() const {
+        return stamp.pinned([&]{return std::vector<T>(data, data + count);});
+    }
+
+private:
+    friend class FrameArena;
+
+    FrameSpan(detail::FrameStamp stamp, const T* data, std::size_t count): stamp(stamp), data(data), count(count) {}
+
+    detail::FrameStamp stamp;
+    const T* data = nullptr;
+    std::size_t count = 0;
+};
+
+// A string allocated in a FrameArena, with the same rules as FrameRef.
+class FrameString {
+public:
+    FrameString() = default;
+
+    std::string_view view() const {
+        stamp.check();
+        return std::string_view(data, length);
+    }
+
+    std::size_t size() const {return length;}
+
+    std::string copy_out() const {
+        return stamp.pinned([&]{return std::string(data, length);});
+    }
+
+private:
+    friend class FrameArena;
+
+    FrameString(detail::FrameStamp stamp, const char* data, std::size_t length): stamp(stamp), data(data), length(length) {}
+
+    detail::FrameStamp stamp;
+    const char* data = nullptr;
+    std::size_t length = 0;
+};
+
+// A bump allocator for things that only live for one frame, e.g. the payloads of the
+// events handled during it. Allocating is a pointer bump and end_frame frees everything
+// at once, so the event hot path doesn't go through malloc. Memory is kept for the
+// next frame, once the arena has grown to fit the busiest frame it doesn't allocate
+// again. Nothing allocated in it is ever destroyed, so it only takes trivially
+// destructible types.
+//
+// Allocating and end_frame are for one thread, normally the main loop's. Handles to
+// what was allocated check they are used within their frame, see FrameRef.
+class FrameArena {
+public:
+    static constexpr std::size_t default_chunk_bytes = 64 * 1024;
+
+    explicit FrameArena(std::size_t chunk_bytes = default_chunk_bytes): chunk_bytes(std::max<std::size_t>(chunk_bytes, 64)) {}
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // Uninitialised memory that is valid until end_frame.
+    void* allocate(std::size_t bytes, std::size_t align = alignof(std::max_align_t)) {
+        for (std::size_t i = current; i < chunks.size(); i++) {
+            if (void* p = chunks[i].take(bytes, align)) {
+                used += bytes;
+                return p;
+            }
+            // Only a small allocation not fitting means the chunk is full, a big one
+            // can go further along and leave the room for the small ones after it.
+            if (i == current && bytes <= chunk_bytes / 4) {
+                current++;
+            }
+        }
+        // Bigger than a chunk gets a chunk of its own.
+        chunks.emplace_back(std::max(chunk_bytes, bytes + align));
+        used += bytes;
+        return chunks.back().take(bytes, align);
+    }
+
+    template<typename T, typename...ArgTs>
+    FrameRef<T> make(ArgTs&&...args) {
+        static_assert(std::is_trivially_destructible_v<T>, "FrameArena never runs destructors");
+        T* value = new (allocate(sizeof(T), alignof(T))) T(std::forward<ArgTs>(args)...);
+        return FrameRef<T>(stamp(), value);
+    }
+
+    template<typename T>
+    FrameSpan<T> copy(Span<const T> values) {
+        static_assert(std::is_trivially_copyable_v<T>, "FrameArena copies arrays with memcpy");
+        T* data = static_cast<T*>(allocate(values.size() * sizeof(T), alignof(T)));
+        if (values.size() != 0) {
+            std::memcpy(data, values.data(), values.size() * sizeof(T));
+        }
+        return FrameSpan<T>(stamp(), data, values.size());
+    }
+
+    FrameString copy(std::string_view s) {
+        char* data = static_cast<char*>(allocate(s.size(), 1));
+        if (!s.empty()) {
+            std::memcpy(data, s.data(), s.size());
+        }
+        return FrameString(stamp(), data, s.size());
+    }
+
+    // Frees everything allocated this frame, handles made before now go stale. Waits
+    // for copy_outs that are part way through on other threads.
+    void end_frame() {
+        frame_.fetch_add(1, std::memory_order_seq_cst);
+        while (copying.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+        for (auto& chunk: chunks) {
+            chunk.used = 0;
+        }
+        current = 0;
+        used = 0;
+    }
+
+    std::uint64_t frame() const {return frame_.load(std::memory_order_relaxed);}
+
+    // Bytes handed out this frame, not counting alignment padding.
+    std::size_t bytes_used() const {return used;}
+
+    std::size_t capacity() const {
+        std::size_t total = 0;
+        for (auto& chunk: chunks) {
+            total += chunk.size;
+        }
+        return total;
+    }
+
+private:
+    friend struct detail::FrameStamp;
+
+    struct Chunk {
+        explicit Chunk(std::size_t size): bytes(new unsigned char[size]), size(size) {}
+
+        void* take(std::size_t n, std::size_t align) {
+            auto base = reinterpret_cast<std::uintptr_t>(bytes.get());
+            std::size_t start = ((base + used + align - 1) & ~(std::uintptr_t(align) - 1)) - base;
+            if (start > size || n > size - start) {
+                return nullptr;
+            }
+            used = start + n;
+            return bytes.get() + start;
+        }
+
+        std::unique_ptr<unsigned char[]> bytes;
+        std::size_t size;
+        std::size_t used = 0;
+    };
+
+    detail::FrameStamp stamp() const {return detail::FrameStamp{this, frame()};}
+
+    std::size_t chunk_bytes;
+    std::vector<Chunk> chunks;
+    // The chunk being bumped, the ones before it are full for this frame.
+    std::size_t current = 0;
+    std::size_t used = 0;
+    std::atomic<std::uint64_t> frame_{0};
+    // copy_outs in progress.
+    mutable std::atomic<std::size_t> copying{0};
+};
+
+inline void detail::FrameStamp::check() const {
+    if (!arena || arena->frame() != frame) {
+        throw StaleFrameRef{};
+    }
+}
+
+// Same handshake as Buffered's sleeping flag: either end_frame sees copying or the copy
+// sees the new frame.
+template<typename F>
+std::invoke_result_t<F&> detail::FrameStamp::pinned(F&& copy) const {
+    if (!arena) {
+        throw StaleFrameRef{};
+    }
+    struct Unpin {
+        std::atomic<std::size_t>& copying;
+        ~Unpin() {copying.fetch_sub(1, std::memory_order_release);}
+    };
+    arena->copying.fetch_add(1, std::memory_order_seq_cst);
+    Unpin unpin{arena->copying};
+    if (arena->frame_.load(std::memory_order_seq_cst) != frame) {
+        throw StaleFrameRef{};
+    }
+    return copy();
+}
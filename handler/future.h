@@ -0,0 +1,495 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <future>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#include "completion.h"
+#include "executor.h"
+#include "pool_allocator.h"
+
+template<typename T>
+class Future;
+
+namespace detail {
+    // Shared state of a Future. Whoever sets the result and whoever attaches the
+    // continuation each set a flag, the second one to arrive runs the continuation.
+    struct FutureStateBase {
+        enum Flags: std::uint32_t {
+            HasResult = 1,
+            HasCallback = 2,
+        };
+
+        virtual ~FutureStateBase() = default;
+
+        static void* operator new(std::size_t size) {return shared_state_pool().allocate(size);}
+        static void operator delete(void* p, std::size_t size) {shared_state_pool().deallocate(p, size);}
+
+        void add_ref() {refs.fetch_add(1, std::memory_order_relaxed);}
+
+        void release() {
+            if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
+
+        bool ready() const {return flags.load(std::memory_order_acquire) & HasResult;}
+
+        void wait() const {backoff_wait([this]{return ready();});}
+
+        std::atomic<std::uint32_t> flags{0};
+        std::atomic<std::uint32_t> refs{1};
+    };
+
+    template<typename T>
+    struct FutureState;
+
+    template<typename T>
+    struct FutureCallback {
+        // Called once, on the thread that set the result or attached the callback.
+        virtual void on_ready(FutureState<T>& state) = 0;
+    };
+
+    template<typename T>
+    struct FutureState: FutureStateBase {
+        std::optional<completion_value_t<T>> value;
+        std::exception_ptr error;
+        FutureCallback<T>* callback = nullptr;
+
+        template<typename...Args>
+        void set_value(Args&&...args) {
+            value.emplace(std::forward<Args>(args)...);
+            publish();
+        }
+
+        void set_exception(std::exception_ptr e) {
+            error = std::move(e);
+            publish();
+        }
+
+        void attach(FutureCallback<T>& c) {
+            callback = &c;
+            if (flags.fetch_or(HasCallback, std::memory_order_acq_rel) & HasResult) {
+                c.on_ready(*this);
+            }
+        }
+
+        // Only once the result is ready.
+        T take() {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            if constexpr (!std::is_void_v<T>) {
+                return std::move(*value);
+            }
+        }
+
+        void forward_to(FutureState<T>& to) {
+            if (error) {
+                to.set_exception(error);
+            } else if constexpr (std::is_void_v<T>) {
+                to.set_value();
+            } else {
+                to.set_value(std::move(*value));
+            }
+        }
+
+    private:
+        void publish() {
+            if (flags.fetch_or(HasResult, std::memory_order_acq_rel) & HasCallback) {
+                callback->on_ready(*this);
+            }
+        }
+    };
+
+    template<typename T>
+    FutureState<T>*& state_of(Future<T>& future);
+
+    // Result sink for Buffered::async. Like std::promise an unset result breaks the future.
+    template<typename T>
+    struct FutureResult {
+        explicit FutureResult(FutureState<T>* state): state(state) {}
+        FutureResult(FutureResult&& other): state(std::exchange(other.state, nullptr)) {}
+        FutureResult& operator=(FutureResult&&) = delete;
+
+        ~FutureResult() {
+            if (state) {
+                fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+        }
+
+        template<typename F>
+        void run(F&& f) {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    f();
+                    state->set_value();
+                } else {
+                    state->set_value(f());
+                }
+            } catch (...) {
+                state->set_exception(std::current_exception());
+            }
+            std::exchange(state, nullptr)->release();
+        }
+
+        void fail(std::exception_ptr e) {
+            state->set_exception(std::move(e));
+            std::exchange(state, nullptr)->release();
+        }
+
+        FutureState<T>* state;
+    };
+
+    template<typename T>
+    struct is_future: std::false_type {};
+
+    template<typename T>
+    struct is_future<Future<T>>: std::true_type {};
+
+    template<typename T, typename F>
+    struct then_result {
+        using type = std::invoke_result_t<F&, T&&>;
+    };
+
+    template<typename F>
+    struct then_result<void, F> {
+        using type = std::invoke_result_t<F&>;
+    };
+
+    template<typename T>
+    struct unwrap_future {
+        using type = T;
+    };
+
+    template<typename T>
+    struct unwrap_future<Future<T>> {
+        using type = T;
+    };
+
+    // The continuation created by Future::then. It is the state of the Future then returns,
+    // the callback for the Future it was called on and, when SchedulerT isn't void, the task
+    // that runs f on the scheduler. If f returns a Future its result is passed through.
+    template<typename T, typename F, typename SchedulerT>
+    struct ThenState:
+        FutureState<typename unwrap_future<typename then_result<T, F>::type>::type>,
+        Task
+    {
+        using ResultT = typename then_result<T, F>::type;
+        using ValueT = typename unwrap_future<ResultT>::type;
+
+        struct Upstream: FutureCallback<T> {
+            explicit Upstream(ThenState* self): self(self) {}
+            ThenState* self;
+            void on_ready(FutureState<T>&) override {self->upstream_ready();}
+        };
+
+        struct Inner: FutureCallback<ValueT> {
+            explicit Inner(ThenState* self): self(self) {}
+            ThenState* self;
+            void on_ready(FutureState<ValueT>& inner) override {
+                inner.forward_to(*self);
+                inner.release();
+                self->release();
+            }
+        };
+
+        ThenState(F f, FutureState<T>* upstream, SchedulerT* scheduler):
+            Task{&ThenState::run_task},
+            f(std::move(f)),
+            upstream(upstream),
+            scheduler(scheduler),
+            upstream_callback(this),
+            inner_callback(this)
+        {
+            // One reference for the returned Future, one until the result is set.
+            this->add_ref();
+        }
+
+        F f;
+        FutureState<T>* upstream;
+        SchedulerT* scheduler;
+        Upstream upstream_callback;
+        Inner inner_callback;
+
+        void upstream_ready() {
+            if constexpr (std::is_void_v<SchedulerT>) {
+                run();
+            } else {
+                scheduler->schedule(*this);
+            }
+        }
+
+        static void run_task(Task& task) {
+            static_cast<ThenState&>(task).run();
+        }
+
+        void run() {
+            FutureState<T>* up = std::exchange(upstream, nullptr);
+            bool done = true;
+            if (up->error) {
+                this->set_exception(up->error);
+            } else {
+                try {
+                    if constexpr (is_future<ResultT>::value) {
+                        ResultT inner = invoke(*up);
+                        FutureState<ValueT>* inner_state = std::exchange(state_of(inner), nullptr);
+                        if (!inner_state) {
+                            throw std::future_error(std::future_errc::no_state);
+                        }
+                        inner_state->attach(inner_callback);
+                        done = false;
+                    } else if constexpr (std::is_void_v<ResultT>) {
+                        invoke(*up);
+                        this->set_value();
+                    } else {
+                        this->set_value(invoke(*up));
+                    }
+                } catch (...) {
+                    this->set_exception(std::current_exception());
+                }
+            }
+            up->release();
+            if (done) {
+                this->release();
+            }
+        }
+
+        ResultT invoke(FutureState<T>& up) {
+            if constexpr (std::is_void_v<T>) {
+                return f();
+            } else {
+                return f(std::move(*up.value));
+            }
+        }
+    };
+
+    // when_all and when_any wait on a set of inputs through Slots, then finish once
+    // every input has arrived.
+    template<typename ValueT, typename T>
+    struct Join: FutureState<ValueT> {
+        struct Slot: FutureCallback<T> {
+            Slot(Join* self, FutureState<T>* input, std::size_t index): self(self), input(input), index(index) {}
+            Join* self;
+            FutureState<T>* input;
+            std::size_t index;
+            void on_ready(FutureState<T>&) override {self->arrived(*this);}
+        };
+
+        explicit Join(std::vector<Future<T>>& futures): remaining(futures.size()) {
+            for (auto& future: futures) {
+                if (!future.valid()) {
+                    throw std::future_error(std::future_errc::no_state);
+                }
+            }
+            slots.reserve(futures.size());
+            for (std::size_t i = 0; i < futures.size(); i++) {
+                slots.emplace_back(this, std::exchange(state_of(futures[i]), nullptr), i);
+            }
+        }
+
+        // Must be called once, after construction. Holds a reference until every input is in.
+        void start() {
+            this->add_ref();
+            if (slots.empty()) {
+                finish();
+                this->release();
+                return;
+            }
+            for (auto& slot: slots) {
+                slot.input->attach(slot);
+            }
+        }
+
+        void arrived(Slot& slot) {
+            on_arrival(slot);
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                finish();
+                for (auto& s: slots) {
+                    s.input->release();
+                }
+                this->release();
+            }
+        }
+
+        virtual void on_arrival(Slot&) {}
+        virtual void finish() = 0;
+
+        std::vector<Slot> slots;
+        std::atomic<std::size_t> remaining;
+    };
+
+    template<typename T>
+    struct WhenAll: Join<std::vector<completion_value_t<T>>, T> {
+        using Join<std::vector<completion_value_t<T>>, T>::Join;
+
+        void finish() override {
+            std::vector<completion_value_t<T>> values;
+            values.reserve(this->slots.size());
+            for (auto& slot: this->slots) {
+                if (slot.input->error) {
+                    this->set_exception(slot.input->error);
+                    return;
+                }
+                values.push_back(std::move(*slot.input->value));
+            }
+            this->set_value(std::move(values));
+        }
+    };
+
+    template<typename T>
+    struct WhenAny: Join<std::pair<std::size_t, completion_value_t<T>>, T> {
+        using Join<std::pair<std::size_t, completion_value_t<T>>, T>::Join;
+
+        std::atomic<bool> won{false};
+
+        void on_arrival(typename WhenAny::Slot& slot) override {
+            if (won.exchange(true, std::memory_order_acq_rel)) {
+                return;
+            }
+            if (slot.input->error) {
+                this->set_exception(slot.input->error);
+            } else {
+                this->set_value(slot.index, std::move(*slot.input->value));
+            }
+        }
+
+        void finish() override {
+            if (this->slots.empty()) {
+                this->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::no_state)));
+            }
+        }
+    };
+}
+
+// A std::future that can be continued instead of waited on. then(f) calls f with the value
+// as soon as it is ready, on the thread that completes it (or straight away if it already
+// is), or on a scheduler such as an Executor or LoopScheduler, and returns a Future for f's
+// result. If f itself returns a Future that is unwrapped. Errors skip f and are passed on
+// to the returned Future. then consumes the Future it is called on.
+//
+// get/wait block like Completion, use them at the edges and then() in between.
+template<typename T>
+class [[nodiscard]] Future {
+public:
+    Future() = default;
+
+    // Takes over a reference to state.
+    explicit Future(detail::FutureState<T>* state): state(state) {}
+
+    Future(Future&& other): state(std::exchange(other.state, nullptr)) {}
+
+    Future& operator=(Future&& other) {
+        Future(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+
+    ~Future() {
+        if (state) {
+            state->release();
+        }
+    }
+
+    bool valid() const {return state != nullptr;}
+    bool ready() const {return state && state->ready();}
+
+    void wait() const {
+        if (!state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        state->wait();
+    }
+
+    T get() {
+        wait();
+        struct Release {
+            detail::FutureState<T>* state;
+            ~Release() {state->release();}
+        } guard{std::exchange(state, nullptr)};
+        return guard.state->take();
+    }
+
+    template<typename F>
+    auto then(F f) && {
+        return continue_with<void>(std::move(f), nullptr);
+    }
+
+    template<typename SchedulerT, typename F>
+    auto then(SchedulerT& scheduler, F f) && {
+        return continue_with<SchedulerT>(std::move(f), &scheduler);
+    }
+
+    void swap(Future& other) {std::swap(state, other.state);}
+
+private:
+    detail::FutureState<T>* state = nullptr;
+
+    template<typename U>
+    friend detail::FutureState<U>*& detail::state_of(Future<U>& future);
+
+    template<typename SchedulerT, typename F>
+    auto continue_with(F f, SchedulerT* scheduler) {
+        if (!state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        using StateT = detail::ThenState<T, F, SchedulerT>;
+        auto* then_state = new StateT(std::move(f), std::exchange(state, nullptr), scheduler);
+        Future<typename StateT::ValueT> result(then_state);
+        then_state->upstream->attach(then_state->upstream_callback);
+        return result;
+    }
+};
+
+namespace detail {
+    template<typename T>
+    FutureState<T>*& state_of(Future<T>& future) {return future.state;}
+}
+
+// Becomes ready with every value, in order, once all of futures are. Fails with the
+// first error (in order) if any of them fail. void results are detail::NoValue.
+template<typename T>
+Future<std::vector<detail::completion_value_t<T>>> when_all(std::vector<Future<T>> futures) {
+    auto* state = new detail::WhenAll<T>(futures);
+    Future<std::vector<detail::completion_value_t<T>>> result(state);
+    state->start();
+    return result;
+}
+
+template<typename T, typename...Rest>
+auto when_all(Future<T> first, Future<Rest>...rest) {
+    static_assert((std::is_same_v<T, Rest> && ...), "when_all takes futures of one type");
+    std::vector<Future<T>> futures;
+    futures.reserve(1 + sizeof...(Rest));
+    futures.push_back(std::move(first));
+    (futures.push_back(std::move(rest)), ...);
+    return when_all(std::move(futures));
+}
+
+// Becomes ready with the index and value of whichever of futures is ready first, or
+// with its error.
+template<typename T>
+Future<std::pair<std::size_t, detail::completion_value_t<T>>> when_any(std::vector<Future<T>> futures) {
+    auto* state = new detail::WhenAny<T>(futures);
+    Future<std::pair<std::size_t, detail::completion_value_t<T>>> result(state);
+    state->start();
+    return result;
+}
+
+template<typename T, typename...Rest>
+auto when_any(Future<T> first, Future<Rest>...rest) {
+    static_assert((std::is_same_v<T, Rest> && ...), "when_any takes futures of one type");
+    std::vector<Future<T>> futures;
+    futures.reserve(1 + sizeof...(Rest));
+    futures.push_back(std::move(first));
+    (futures.push_back(std::move(rest)), ...);
+    return when_any(std::move(futures));
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "meta.h"
+#include "parallel.h"
+
+namespace detail {
+    template<typename HandlerT, typename CtxT, typename RequestT>
+    using gather_result_t = std::decay_t<decltype(std::declval<HandlerT&>()(std::declval<CtxT&>(), std::declval<const RequestT&>()))>;
+
+    template<typename T, typename...Ts>
+    constexpr bool all_same_v = (std::is_same_v<T, Ts> && ...);
+}
+
+// Asks every matching handler concurrently, the same way Parallel runs event handlers, and
+// returns all of their answers in handler order. When every handler answers with the same
+// type the answers come back as a std::array, otherwise as a std::tuple, either way they
+// can be unpacked with structured bindings. Handlers only get a const RequestT& and must
+// return a value, std::optional answers are returned as they are.
+template<typename ...HandlerTs>
+class Gather {
+public:
+    Gather(HandlerTs...handlers): Gather(Executor::shared(), std::move(handlers)...) {}
+
+    Gather(Executor& executor, HandlerTs...handlers): handlers(std::move(handlers)...), executor(&executor) {}
+
+    template<typename CtxT, typename RequestT, typename = std::enable_if_t<any_dispatch_match<std::tuple<CtxT&, RequestT>, HandlerTs...>()>>
+    auto operator() (CtxT& ctx, RequestT&& request) {
+        constexpr auto matches = dispatch_match_indices<std::tuple<CtxT&, RequestT>, HandlerTs...>();
+        return run(ctx, static_cast<const remove_cvref_t<RequestT>&>(request), matches, std::make_index_sequence<matches.size()>{});
+    }
+
+    template<typename CtxT>
+    void operator() (CtxT&, NoRequestHandlerError) = delete;
+private:
+    HandlerTuple<HandlerTs...> handlers;
+    Executor* executor;
+
+    template<std::size_t I, typename CtxT, typename RequestT>
+    using result_t = detail::gather_result_t<handler_element_t<I, HandlerTuple<HandlerTs...>>, CtxT, RequestT>;
+
+    // Is are the matching handlers, Ks their positions in the result.
+    template<typename CtxT, typename RequestT, std::size_t...Is, std::size_t...Ks>
+    auto run(CtxT& ctx, const RequestT& request, std::index_sequence<Is...>, std::index_sequence<Ks...>) {
+        static_assert(!(std::is_void_v<result_t<Is, CtxT, RequestT>> || ...), "Gather handlers must return a value");
+
+        std::tuple<std::optional<result_t<Is, CtxT, RequestT>>...> results;
+        constexpr std::size_t handler_index[] = {Is...};
+        auto calls = std::make_tuple([&]{
+            std::get<Ks>(results).emplace(get_handler<handler_index[Ks]>(handlers)(ctx, request));
+        }...);
+        std::apply([&](auto&...fs){detail::fork_join(*executor, fs...);}, calls);
+
+        if constexpr (detail::all_same_v<result_t<Is, CtxT, RequestT>...>) {
+            using ResultT = std::tuple_element_t<0, std::tuple<result_t<Is, CtxT, RequestT>...>>;
+            return std::array<ResultT, sizeof...(Is)>{std::move(*std::get<Ks>(results))...};
+        } else {
+            return std::tuple<result_t<Is, CtxT, RequestT>...>{std::move(*std::get<Ks>(results))...};
+        }
+    }
+};
+
+template<typename...HandlerTs>
+Gather(HandlerTs...) -> Gather<HandlerTs...>;
+
+template<typename...HandlerTs>
+Gather(Executor&, HandlerTs...) -> Gather<HandlerTs...>;
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace detail {
+    struct AtomicLatencyHistogram;
+}
+
+// Latencies in nanoseconds bucketed log-linearly the way HdrHistogram does: values below
+// 32 get a bucket each, above that every power of two is split into 16 buckets, so any
+// value is within 1/16 of its bucket's lower bound. Values from 2^40 ns (about 18 minutes)
+// up all land in the last bucket.
+class LatencyHistogram {
+public:
+    static constexpr std::size_t sub_buckets = 16;
+    // Two rows for 0-31, then one per power of two from 2^5 to 2^39.
+    static constexpr std::size_t buckets = 37 * sub_buckets;
+
+    static std::size_t bucket_of(std::uint64_t ns) {
+        int magnitude = 63 - __builtin_clzll(ns | 1);
+        int shift = std::max(magnitude - 4, 0);
+        return std::min<std::size_t>(shift * sub_buckets + (ns >> shift), buckets - 1);
+    }
+
+    static std::uint64_t lower_bound(std::size_t bucket) {
+        if (bucket < 2 * sub_buckets) {
+            return bucket;
+        }
+        std::size_t shift = bucket / sub_buckets - 1;
+        return std::uint64_t(bucket % sub_buckets + sub_buckets) << shift;
+    }
+
+    void record(std::uint64_t ns) {
+        counts[bucket_of(ns)]++;
+        total++;
+        sum += ns;
+        max_ = std::max(max_, ns);
+    }
+
+    std::uint64_t count() const {return total;}
+    std::uint64_t max() const {return max_;}
+    double mean() const {return total ? double(sum) / total : 0.0;}
+    std::uint64_t bucket_count(std::size_t bucket) const {return counts[bucket];}
+
+    // Lower bound of the bucket holding the q-th quantile, q in [0, 1].
+    std::uint64_t percentile(double q) const {
+        if (total == 0) {
+            return 0;
+        }
+        std::uint64_t rank = std::max<std::uint64_t>(1, std::uint64_t(q * total + 0.5));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < buckets; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(lower_bound(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (std::size_t i = 0; i < buckets; i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        max_ = std::max(max_, other.max_);
+    }
+
+private:
+    friend struct detail::AtomicLatencyHistogram;
+
+    std::array<std::uint64_t, buckets> counts{};
+    std::uint64_t total = 0;
+    std::uint64_t sum = 0;
+    std::uint64_t max_ = 0;
+};
+
+namespace detail {
+    // A LatencyHistogram made of relaxed atomics, so other threads can read it while it is
+    // recorded into. An exclusive writer (one thread at a time, handed over with a
+    // release/acquire pair) updates it with plain loads and stores, shared writers use
+    // read-modify-writes.
+    struct AtomicLatencyHistogram {
+        std::atomic<std::uint64_t> sum{0};
+        std::atomic<std::uint64_t> max{0};
+        std::array<std::atomic<std::uint64_t>, LatencyHistogram::buckets> counts{};
+
+        static void add(std::atomic<std::uint64_t>& counter, std::uint64_t n, bool exclusive) {
+            if (exclusive) {
+                counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            } else {
+                counter.fetch_add(n, std::memory_order_relaxed);
+            }
+        }
+
+        void record(std::uint64_t ns, bool exclusive) {
+            add(counts[LatencyHistogram::bucket_of(ns)], 1, exclusive);
+            add(sum, ns, exclusive);
+            // Racy between shared writers, the max is only a hint there.
+            if (ns > max.load(std::memory_order_relaxed)) {
+                max.store(ns, std::memory_order_relaxed);
+            }
+        }
+
+        void add_to(LatencyHistogram& out) const {
+            for (std::size_t i = 0; i < LatencyHistogram::buckets; i++) {
+                std::uint64_t n = counts[i].load(std::memory_order_relaxed);
+                out.counts[i] += n;
+                out.total += n;
+            }
+            out.sum += sum.load(std::memory_order_relaxed);
+            out.max_ = std::max(out.max_, max.load(std::memory_order_relaxed));
+        }
+    };
+}
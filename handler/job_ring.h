@@ -0,0 +1,405 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+#include "producers.h"
+
+namespace detail {
+    // Most jobs JobRing::run_batch runs in one go.
+    inline constexpr std::size_t max_job_batch = 64;
+
+    using RunBatchFn = void(*)(unsigned char** records, std::size_t count);
+
+    struct JobOps {
+        // Runs the job stored in the record and then destroys it.
+        void (*run)(unsigned char* record);
+        // Destroys the job stored in the record without running it.
+        void (*destroy)(unsigned char* record);
+        // If not null, runs and destroys count consecutive jobs of this type together.
+        RunBatchFn run_batch;
+    };
+
+    // A job type F opts into batching with
+    //     static constexpr bool batchable = true;
+    //     static void run_batch(F** jobs, std::size_t count);
+    // run_batch runs the jobs but doesn't destroy them.
+    template<typename F, typename = void>
+    struct is_batchable_job: std::false_type {};
+
+    template<typename F>
+    struct is_batchable_job<F, std::enable_if_t<F::batchable>>: std::true_type {};
+
+    // Lets a wrapper job forward batches to the job it wraps.
+    template<typename OuterT, typename InnerT, typename GetInnerF>
+    void run_inner_batch(OuterT** jobs, std::size_t count, GetInnerF get_inner) {
+        InnerT* inner[max_job_batch];
+        for (std::size_t i = 0; i < count; i++) {
+            inner[i] = &get_inner(*jobs[i]);
+        }
+        InnerT::run_batch(inner, count);
+    }
+
+    // A record is a pointer to the job's JobOps followed by the job itself.
+    template<typename F>
+    struct InlineJobOps {
+        static constexpr std::size_t payload_offset = alignof(F) > sizeof(const JobOps*) ? alignof(F) : sizeof(const JobOps*);
+
+        static F& get(unsigned char* record) {
+            return *std::launder(reinterpret_cast<F*>(record + payload_offset));
+        }
+
+        static void run(unsigned char* record) {
+            F& f = get(record);
+            struct Destroy {
+                F& f;
+                ~Destroy() {f.~F();}
+            } destroy{f};
+            f();
+        }
+
+        static void destroy(unsigned char* record) {
+            get(record).~F();
+        }
+
+        static void run_batch(unsigned char** records, std::size_t count) {
+            F* jobs[max_job_batch];
+            for (std::size_t i = 0; i < count; i++) {
+                jobs[i] = &get(records[i]);
+            }
+            struct Destroy {
+                F** jobs;
+                std::size_t count;
+                ~Destroy() {
+                    for (std::size_t i = 0; i < count; i++) {
+                        jobs[i]->~F();
+                    }
+                }
+            } destroy{jobs, count};
+            F::run_batch(jobs, count);
+        }
+
+        static constexpr RunBatchFn batch_fn() {
+            if constexpr (is_batchable_job<F>::value) {
+                return &run_batch;
+            } else {
+                return nullptr;
+            }
+        }
+
+        static constexpr JobOps ops{&run, &destroy, batch_fn()};
+    };
+
+    // Jobs whose captures don't fit inline in the ring are boxed on the heap and
+    // only the pointer is stored in the ring.
+    template<typename F>
+    struct HeapJob {
+        // Only allocates once the ring has room for the HeapJob, so a full ring
+        // never costs an allocation.
+        template<typename FwdF>
+        HeapJob(FwdF&& f): f(std::make_unique<F>(std::forward<FwdF>(f))) {}
+
+        std::unique_ptr<F> f;
+        void operator()() {(*f)();}
+
+        static constexpr bool batchable = is_batchable_job<F>::value;
+        static void run_batch(HeapJob** jobs, std::size_t count) {
+            run_inner_batch<HeapJob, F>(jobs, count, [](HeapJob& job) -> F& {return *job.f;});
+        }
+    };
+
+    constexpr std::size_t next_pow2(std::size_t n) {
+        std::size_t r = 1;
+        while (r < n) {
+            r <<= 1;
+        }
+        return r;
+    }
+}
+
+// Stores type erased void() jobs as variable size records in one preallocated block of
+// memory, so queueing a job doesn't allocate. The block is split into cache line sized
+// slots and each record takes one or more consecutive slots, a record never wraps around
+// the end of the block, instead a padding record fills the remaining slots.
+//
+// Producers claim slots by moving head forward, construct the job in place and then
+// publish it by storing the record's slot count in published[first slot]. The consumer
+// runs published records in order and clears published before giving the slots back
+// by moving tail forward.
+//
+// Only one thread may call try_run_one/empty at a time.
+template<Producers P = Producers::Multi>
+class JobRing {
+public:
+    static constexpr std::size_t slot_size = detail::cache_line;
+    // Jobs bigger than this are stored on the heap.
+    static constexpr std::size_t max_inline_slots = 4;
+
+    explicit JobRing(std::size_t min_slots):
+        slot_count(detail::next_pow2(min_slots < 2 * max_inline_slots ? 2 * max_inline_slots : min_slots)),
+        slots(new Slot[slot_count]),
+        published(new std::atomic<std::uint32_t>[slot_count]),
+        head(0),
+        tail(0),
+        cached_tail(0),
+        consumer_pos(0)
+    {
+        for (std::size_t i = 0; i < slot_count; i++) {
+            published[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~JobRing() {
+        while (!empty()) {
+            pop([](const detail::JobOps& ops, unsigned char* record){ops.destroy(record);});
+        }
+    }
+
+    JobRing(const JobRing&) = delete;
+    JobRing(JobRing&&) = delete;
+
+    JobRing& operator=(const JobRing&) = delete;
+    JobRing& operator=(JobRing&&) = delete;
+
+    // Returns false without touching f if there is no room for the job.
+    template<typename F>
+    bool try_push(F&& f) {
+        using JobT = std::decay_t<F>;
+        if constexpr (fits_inline<JobT>()) {
+            return try_emplace<JobT>(std::forward<F>(f));
+        } else {
+            return try_emplace<detail::HeapJob<JobT>>(std::forward<F>(f));
+        }
+    }
+
+    // Runs the oldest job, returns false if there wasn't one.
+    bool try_run_one() {
+        if (empty()) {
+            return false;
+        }
+        pop([](const detail::JobOps& ops, unsigned char* record){ops.run(record);});
+        return true;
+    }
+
+    // Runs up to max_jobs of the oldest jobs and returns how many were run. Consecutive
+    // jobs of the same batchable type are run with one call to their run_batch, and the
+    // slots of all the jobs are handed back to producers in one go at the end. If cancel
+    // gets set part way through, the jobs that haven't been started are destroyed instead.
+    std::size_t run_batch(std::size_t max_jobs = detail::max_job_batch, const std::atomic<bool>* cancel = nullptr) {
+        if (max_jobs > detail::max_job_batch) {
+            max_jobs = detail::max_job_batch;
+        }
+
+        unsigned char* records[detail::max_job_batch];
+        const detail::JobOps* ops[detail::max_job_batch];
+        std::size_t count = 0;
+        std::size_t pos = consumer_pos;
+        // A full ring has every published word set, stop after one lap.
+        while (count < max_jobs && pos - consumer_pos < slot_count) {
+            std::uint32_t word = published[pos & (slot_count - 1)].load(std::memory_order_acquire);
+            if (word == 0) {
+                break;
+            }
+            if (!(word & padding_bit)) {
+                records[count] = slots[pos & (slot_count - 1)].bytes;
+                ops[count] = *reinterpret_cast<const detail::JobOps**>(records[count]);
+                count++;
+            }
+            pos += word & ~padding_bit;
+        }
+
+        // Hands the slots back even if a job throws.
+        struct Release {
+            JobRing& ring;
+            std::size_t end;
+            ~Release() {
+                while (ring.consumer_pos != end) {
+                    auto& word = ring.published[ring.consumer_pos & (ring.slot_count - 1)];
+                    std::uint32_t slots = word.load(std::memory_order_relaxed) & ~padding_bit;
+                    word.store(0, std::memory_order_relaxed);
+                    ring.consumer_pos += slots;
+                }
+                ring.tail.store(end, std::memory_order_release);
+            }
+        } release{*this, pos};
+
+        std::size_t next = 0;
+        try {
+            while (next < count) {
+                if (cancel && cancel->load(std::memory_order_relaxed)) {
+                    break;
+                }
+                std::size_t group = next;
+                next++;
+                if (ops[group]->run_batch) {
+                    while (next < count && ops[next] == ops[group]) {
+                        next++;
+                    }
+                }
+
+                if (next - group > 1) {
+                    ops[group]->run_batch(records + group, next - group);
+                } else {
+                    ops[group]->run(records[group]);
+                }
+            }
+        } catch (...) {
+            // the jobs that threw destroyed themselves, the ones after them won't be run
+            for (; next < count; next++) {
+                ops[next]->destroy(records[next]);
+            }
+            throw;
+        }
+        for (std::size_t i = next; i < count; i++) {
+            ops[i]->destroy(records[i]);
+        }
+        return count;
+    }
+
+    // Destroys the oldest job without running it, returns false if there wasn't one.
+    bool try_drop_one() {
+        if (empty()) {
+            return false;
+        }
+        pop([](const detail::JobOps& ops, unsigned char* record){ops.destroy(record);});
+        return true;
+    }
+
+    bool empty() {
+        while (true) {
+            std::uint32_t word = published[consumer_pos & (slot_count - 1)].load(std::memory_order_acquire);
+            if (word == 0) {
+                return true;
+            }
+            if (!(word & padding_bit)) {
+                return false;
+            }
+            release(word & ~padding_bit);
+        }
+    }
+
+    // Unlike empty this is safe to call from any thread. It can report claimed
+    // slots whose job hasn't been published yet.
+    bool has_pending() const {
+        return head.load(std::memory_order_acquire) != tail.load(std::memory_order_acquire);
+    }
+
+    std::size_t capacity_slots() const {return slot_count;}
+
+    template<typename F>
+    static constexpr bool fits_inline() {
+        return record_slots<F>() <= max_inline_slots;
+    }
+
+    // Bytes a job of type F takes up once pushed, its slots plus the heap box if
+    // it doesn't fit inline.
+    template<typename F>
+    static constexpr std::size_t footprint() {
+        if constexpr (fits_inline<F>()) {
+            return record_slots<F>() * slot_size;
+        } else {
+            return record_slots<detail::HeapJob<F>>() * slot_size + sizeof(F);
+        }
+    }
+
+private:
+    struct alignas(detail::cache_line) Slot {
+        unsigned char bytes[slot_size];
+    };
+
+    static constexpr std::uint32_t padding_bit = 0x80000000u;
+
+    template<typename F>
+    static constexpr std::size_t record_slots() {
+        if constexpr (alignof(F) > slot_size) {
+            // can't be aligned inside the ring, force it onto the heap
+            return max_inline_slots + 1;
+        } else {
+            return (detail::InlineJobOps<F>::payload_offset + sizeof(F) + slot_size - 1) / slot_size;
+        }
+    }
+
+    const std::size_t slot_count;
+    std::unique_ptr<Slot[]> slots;
+    std::unique_ptr<std::atomic<std::uint32_t>[]> published;
+
+    alignas(detail::cache_line) std::atomic<std::size_t> head;
+    alignas(detail::cache_line) std::atomic<std::size_t> tail;
+    // Producer side cache of tail so producers don't read the consumer's
+    // cache line on every push.
+    alignas(detail::cache_line) std::atomic<std::size_t> cached_tail;
+    // Consumer only.
+    alignas(detail::cache_line) std::size_t consumer_pos;
+
+    template<typename JobT, typename...Args>
+    bool try_emplace(Args&&...args) {
+        constexpr std::size_t needed = record_slots<JobT>();
+        static_assert(needed <= max_inline_slots, "");
+
+        std::size_t pos = head.load(std::memory_order_relaxed);
+        std::size_t padding;
+        while (true) {
+            std::size_t index = pos & (slot_count - 1);
+            padding = index + needed > slot_count ? slot_count - index : 0;
+
+            std::size_t end = pos + padding + needed;
+            // acquire/release on cached_tail chains the consumer's release of the slots
+            // through to producers that didn't load tail themselves.
+            if (end - cached_tail.load(std::memory_order_acquire) > slot_count) {
+                std::size_t t = tail.load(std::memory_order_acquire);
+                cached_tail.store(t, std::memory_order_release);
+                if (end - t > slot_count) {
+                    return false;
+                }
+            }
+
+            if constexpr (P == Producers::Single) {
+                head.store(end, std::memory_order_relaxed);
+                break;
+            } else {
+                if (head.compare_exchange_weak(pos, end, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+        }
+
+        if (padding) {
+            published[pos & (slot_count - 1)].store(padding_bit | static_cast<std::uint32_t>(padding), std::memory_order_release);
+            pos += padding;
+        }
+
+        std::size_t index = pos & (slot_count - 1);
+        unsigned char* record = slots[index].bytes;
+        *reinterpret_cast<const detail::JobOps**>(record) = &detail::InlineJobOps<JobT>::ops;
+        try {
+            new (record + detail::InlineJobOps<JobT>::payload_offset) JobT(std::forward<Args>(args)...);
+        } catch (...) {
+            // The slots are already claimed, hand them to the consumer as padding
+            // so it doesn't wait for them forever.
+            published[index].store(padding_bit | static_cast<std::uint32_t>(needed), std::memory_order_release);
+            throw;
+        }
+        published[index].store(static_cast<std::uint32_t>(needed), std::memory_order_release);
+        return true;
+    }
+
+    template<typename F>
+    void pop(F&& f) {
+        std::size_t index = consumer_pos & (slot_count - 1);
+        std::uint32_t word = published[index].load(std::memory_order_relaxed);
+        unsigned char* record = slots[index].bytes;
+        f(**reinterpret_cast<const detail::JobOps**>(record), record);
+        release(word);
+    }
+
+    void release(std::uint32_t word) {
+        published[consumer_pos & (slot_count - 1)].store(0, std::memory_order_relaxed);
+        consumer_pos += word;
+        tail.store(consumer_pos, std::memory_order_release);
+    }
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "job_ring.h"
+#include "future.h"
+#include "queue_limits.h"
+
+// Jobs posted from any thread and run by whichever thread calls drain, typically the main
+// loop once a frame, so handlers that touch main thread only state (a window, a Vulkan
+// device) can be reached from workers without locks. Jobs are stored inline in a
+// preallocated JobRing like Buffered's, so posting doesn't allocate and costs one CAS.
+//
+// The mailbox has a fixed capacity and never blocks the poster, a job posted while it is
+// full is dropped and counted. Jobs still queued when the mailbox is destroyed are
+// destroyed without being run. Only one thread may drain at a time.
+template<Producers P = Producers::Multi>
+class Mailbox {
+public:
+    explicit Mailbox(std::size_t capacity_slots = 4096): ring(capacity_slots) {}
+
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    // Queues f() to run on the draining thread, returns false if the mailbox was full.
+    template<typename F>
+    bool post(F&& f) {
+        if (ring.try_push(Post<std::decay_t<F>>{std::forward<F>(f), this})) {
+            return true;
+        }
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Like post but returns a Future for f's result, which fails with QueueFull if the
+    // mailbox was full.
+    template<typename F>
+    Future<std::invoke_result_t<std::decay_t<F>&>> call(F&& f) {
+        using ResultT = std::invoke_result_t<std::decay_t<F>&>;
+        auto* state = new detail::FutureState<ResultT>();
+        state->add_ref();
+        Future<ResultT> future(state);
+        Call<std::decay_t<F>, ResultT> job{std::forward<F>(f), detail::FutureResult<ResultT>(state)};
+        if (!ring.try_push(std::move(job))) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            job.result.fail(std::make_exception_ptr(QueueFull{}));
+        }
+        return future;
+    }
+
+    // Runs up to max_jobs of the oldest jobs and returns how many ran. Bounded so a flood
+    // of posts can't stall a frame, whatever is left waits for the next drain. Jobs
+    // posted while draining may or may not be run by this call. If a posted job throws
+    // the rest still run and the first exception is rethrown at the end.
+    std::size_t drain(std::size_t max_jobs = 256) {
+        std::size_t ran = 0;
+        while (ran < max_jobs) {
+            std::size_t n = ring.run_batch(max_jobs - ran);
+            if (n == 0) {
+                break;
+            }
+            ran += n;
+        }
+        if (error) {
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+        return ran;
+    }
+
+    // Safe from any thread, may count a job that is still being posted.
+    bool has_pending() const {return ring.has_pending();}
+
+    // Jobs dropped because the mailbox was full.
+    std::uint64_t dropped() const {return dropped_.load(std::memory_order_relaxed);}
+
+private:
+    template<typename F>
+    struct Post {
+        F f;
+        Mailbox* self;
+
+        void operator()() {
+            try {
+                f();
+            } catch (...) {
+                if (!self->error) {
+                    self->error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    template<typename F, typename ResultT>
+    struct Call {
+        F f;
+        detail::FutureResult<ResultT> result;
+
+        void operator()() {result.run(f);}
+    };
+
+    JobRing<P> ring;
+    std::atomic<std::uint64_t> dropped_{0};
+    // Draining thread only.
+    std::exception_ptr error;
+};
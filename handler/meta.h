@@ -1,5 +1,6 @@
 #pragma once
 #include <tuple>
+#include <optional>
 #include <utility>
 #include <type_traits>
 
@@ -80,19 +81,55 @@ namespace detail {
     template<typename...>
     constexpr std::false_type can_call_impl(...) {return {};}
 
-    template<int I>
-    struct Count{
-        static constexpr int value = I;
-    };
-
-    template<int I>
-    Count<I+1> inc(Count<I>){return {};}
-
     template<typename T>
     constexpr std::false_type is_optional_impl(const T&) {return {};}
 
     template<typename T>
     constexpr std::true_type is_optional_impl(const std::optional<T>&) {return {};} 
+
+    template<typename T, typename...Ts>
+    constexpr bool is_one_of_v = (std::is_same_v<T, Ts> || ...);
+}
+
+namespace detail {
+    template<std::size_t I, typename T>
+    struct HandlerLeaf {
+        T handler;
+    };
+
+    template<typename SeqT, typename...Ts>
+    struct HandlerTupleImpl;
+
+    template<std::size_t...Is, typename...Ts>
+    struct HandlerTupleImpl<std::index_sequence<Is...>, Ts...>: HandlerLeaf<Is, Ts>... {
+        HandlerTupleImpl(Ts...ts): HandlerLeaf<Is, Ts>{std::move(ts)}... {}
+    };
+
+    // Picks the one base with index I, T is deduced.
+    template<std::size_t I, typename T>
+    constexpr T& leaf_get(HandlerLeaf<I, T>& leaf) {return leaf.handler;}
+}
+
+// Storage for the handlers of Serial, First and friends. std::tuple is implemented by
+// recursion and gets very slow to compile (and CTAD with it slower still) with hundreds
+// of handlers, this inherits from one leaf per handler instead.
+template<typename...Ts>
+struct HandlerTuple: detail::HandlerTupleImpl<std::index_sequence_for<Ts...>, Ts...> {
+    HandlerTuple(Ts...ts): detail::HandlerTupleImpl<std::index_sequence_for<Ts...>, Ts...>(std::move(ts)...) {}
+};
+
+template<std::size_t I, typename...Ts>
+constexpr auto& get_handler(HandlerTuple<Ts...>& t) {
+    return detail::leaf_get<I>(t);
+}
+
+template<std::size_t I, typename TupleT>
+using handler_element_t = std::remove_reference_t<decltype(detail::leaf_get<I>(std::declval<TupleT&>()))>;
+
+template<typename...Ts, typename F, size_t...Is>
+constexpr void static_for_each_index(HandlerTuple<Ts...>& t, F func, std::index_sequence<Is...>) {
+    (void) func;
+    (func(get_handler<Is>(t)),...);
 }
 
 template<typename...Ts, typename F, size_t...Is>
@@ -106,6 +143,19 @@ constexpr void static_for_each(std::tuple<Ts...>& t, F func) {
     static_for_each_index(t, func, std::make_index_sequence<sizeof...(Ts)>{});
 }
 
+namespace detail {
+    template<typename T>
+    struct TypeTag {
+        static constexpr char id = 0;
+    };
+}
+
+// Identifies a type at runtime without RTTI, the address of a per type constant.
+using TypeId = const void*;
+
+template<typename T>
+constexpr TypeId type_id_v = &detail::TypeTag<remove_cvref_t<T>>::id;
+
 template<typename F, typename...ArgTs>
 struct can_call {
     static constexpr bool value = decltype(detail::can_call_impl<F, ArgTs...>(0))::value;
@@ -125,33 +175,65 @@ constexpr bool dispatch_match_v = dispatch_match<F, CtxT, ArgT>::value();
 
 
 namespace detail {
-    template<typename First, typename...Rest, typename...ArgTs>
-    constexpr auto count_dispatch_match_impl(const std::tuple<ArgTs...>& args) {
-        if constexpr (dispatch_match_v<First, ArgTs...>) {
-            if constexpr (sizeof...(Rest) > 0) {
-                return detail::inc(count_dispatch_match_impl<Rest...>(args));
-            } else {
-                (void)args;
-                return detail::Count<1>{};
+    // Which of HandlerTs match ArgsTupleT, worked out once per (handler pack, arguments) with a
+    // single pack expansion. Everything below reads from here, so matching many handlers
+    // doesn't instantiate a chain of templates per handler.
+    template<typename ArgsTupleT, typename...HandlerTs>
+    struct DispatchMatches;
+
+    template<typename...ArgTs, typename...HandlerTs>
+    struct DispatchMatches<std::tuple<ArgTs...>, HandlerTs...> {
+        // One flag per handler, the trailing false keeps the array non empty.
+        static constexpr bool mask[] = {dispatch_match_v<HandlerTs, ArgTs...>..., false};
+
+        static constexpr std::size_t count_matches() {
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < sizeof...(HandlerTs); i++) {
+                n += mask[i];
             }
-        } else {
-            if constexpr (sizeof...(Rest) > 0) {
-                return count_dispatch_match_impl<Rest...>(args);
-            } else {
-                (void)args;
-                return detail::Count<0>{};
+            return n;
+        }
+
+        static constexpr std::size_t count = count_matches();
+
+        struct Indices {
+            std::size_t values[count + 1];
+        };
+
+        static constexpr Indices find_indices() {
+            Indices indices{};
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < sizeof...(HandlerTs); i++) {
+                if (mask[i]) {
+                    indices.values[n++] = i;
+                }
             }
+            return indices;
         }
+
+        static constexpr Indices indices = find_indices();
+    };
+
+    template<std::size_t...Is>
+    struct IndexArray {
+        static constexpr std::size_t values[] = {Is..., 0};
+    };
+
+    // index_sequence<Source::values[Ks]...>
+    template<typename SourceT, std::size_t...Ks>
+    constexpr auto pick_indices(std::index_sequence<Ks...>) {
+        return std::index_sequence<SourceT::values[Ks]...>{};
     }
+
+    template<typename MatchesT>
+    struct MatchIndices {
+        static constexpr const std::size_t* values = MatchesT::indices.values;
+    };
 }
 
 template<typename ArgsTupleT, typename...HandlerTs>
 constexpr int count_dispatch_match() {
-    if constexpr (sizeof...(HandlerTs) == 0) {
-        return 0;
-    } else {
-        return decltype(detail::count_dispatch_match_impl<HandlerTs...>(std::declval<ArgsTupleT>()))::value;
-    }
+    return static_cast<int>(detail::DispatchMatches<ArgsTupleT, HandlerTs...>::count);
 }
 
 template<typename ArgsTupleT, typename...HandlerTs>
@@ -193,53 +275,30 @@ constexpr auto seq_append(std::index_sequence<Is...>) {
 
 template<std::size_t...Is>
 constexpr std::size_t last_idx(std::index_sequence<Is...>) {
-    return std::remove_reference_t<decltype(std::get<sizeof...(Is)-1>(std::declval<std::tuple<detail::Count<Is>...>>()))>::value;
+    return detail::IndexArray<Is...>::values[sizeof...(Is) - 1];
 }
 
 template<std::size_t First, std::size_t...Is>
 constexpr auto head_indices(std::index_sequence<First, Is...>) {
-    if constexpr(sizeof...(Is) == 0) {
-        return std::index_sequence<>{};
-    } else {
-        if constexpr(sizeof...(Is) == 1) {
-            return std::index_sequence<First>{};
-        } else {
-            return seq_prepend<First>(head_indices(std::index_sequence<Is...>{}));
-        }
-    }
-}
-
-namespace detail {
-    template<size_t Idx, typename SeqT, typename ArgsTupleT, typename FirstHandlerT, typename...RestHandlerTs>
-    constexpr auto dispatch_match_indices_impl() {
-        if constexpr(any_dispatch_match<ArgsTupleT, FirstHandlerT>()) {
-            using NewSeqT = decltype(seq_append<Idx>(std::declval<SeqT>()));
-            if constexpr(sizeof...(RestHandlerTs) > 0) {
-                return dispatch_match_indices_impl<Idx+1, NewSeqT, ArgsTupleT, RestHandlerTs...>();
-            } else {
-                return NewSeqT{};
-            }
-        } else {
-            if constexpr(sizeof...(RestHandlerTs) > 0) {
-                return dispatch_match_indices_impl<Idx+1, SeqT, ArgsTupleT, RestHandlerTs...>();
-            } else {
-                return SeqT{};
-            }
-        }
-    }
+    return detail::pick_indices<detail::IndexArray<First, Is...>>(std::make_index_sequence<sizeof...(Is)>{});
 }
 
 template<typename ArgsTupleT, typename...HandlerTs>
 constexpr auto dispatch_match_indices() {
-    return decltype(detail::dispatch_match_indices_impl<0, std::index_sequence<>, ArgsTupleT, HandlerTs...>()){};
+    using MatchesT = detail::DispatchMatches<ArgsTupleT, HandlerTs...>;
+    return detail::pick_indices<detail::MatchIndices<MatchesT>>(std::make_index_sequence<MatchesT::count>{});
 }
 
 template<typename ArgsTupleT, typename...HandlerTs>
 constexpr auto dispatch_match_head() {
-    return decltype(head_indices(dispatch_match_indices<ArgsTupleT, HandlerTs...>())){};
+    using MatchesT = detail::DispatchMatches<ArgsTupleT, HandlerTs...>;
+    static_assert(MatchesT::count > 0, "no handler matches");
+    return detail::pick_indices<detail::MatchIndices<MatchesT>>(std::make_index_sequence<MatchesT::count - 1>{});
 }
 
 template<typename ArgsTupleT, typename...HandlerTs>
 constexpr auto dispatch_match_last() {
-    return last_idx(dispatch_match_indices<ArgsTupleT, HandlerTs...>());
+    using MatchesT = detail::DispatchMatches<ArgsTupleT, HandlerTs...>;
+    static_assert(MatchesT::count > 0, "no handler matches");
+    return MatchesT::indices.values[MatchesT::count - 1];
 }
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "meta.h"
+#include "executor.h"
+
+namespace detail {
+    template<typename F>
+    struct ForkTask: Task {
+        ForkTask(F& f, std::atomic<std::size_t>& remaining): Task{&ForkTask::run_task}, f(&f), remaining(&remaining) {}
+
+        F* f;
+        std::atomic<std::size_t>* remaining;
+        std::exception_ptr error;
+
+        static void run_task(Task& task) {
+            auto& self = static_cast<ForkTask&>(task);
+            try {
+                (*self.f)();
+            } catch (...) {
+                self.error = std::current_exception();
+            }
+            // The joining thread may destroy the task as soon as it sees this.
+            self.remaining->fetch_sub(1, std::memory_order_acq_rel);
+        }
+    };
+
+    template<typename TaskT>
+    void run_unscheduled(Executor& executor, TaskT& task) {
+        if (executor.try_unschedule(task)) {
+            task.run(task);
+        }
+    }
+
+    template<typename TaskTup, std::size_t...Is>
+    void fork_join_impl(Executor& executor, TaskTup& tasks, std::atomic<std::size_t>& remaining, std::index_sequence<Is...>) {
+        constexpr std::size_t last = sizeof...(Is) - 1;
+        ((Is != last ? executor.schedule(std::get<Is>(tasks)) : void()), ...);
+        auto& inline_task = std::get<last>(tasks);
+        inline_task.run(inline_task);
+
+        // Forked tasks no thread has got to yet are run here. Only this fork's own
+        // tasks, anything else queued on the executor stays on its threads. That also
+        // keeps a fork-join on one of the executor's own threads from waiting on tasks
+        // queued behind itself.
+        ((Is != last ? run_unscheduled(executor, std::get<Is>(tasks)) : void()), ...);
+        // The rest are running on the executor's threads.
+        while (remaining.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
+        std::exception_ptr error;
+        ((error = error ? error : std::get<Is>(tasks).error), ...);
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Calls every f concurrently, all but the last on executor and the last on the calling
+    // thread, and returns once they have all finished. If any of them throw the exception
+    // of the first (in argument order) that threw is rethrown.
+    template<typename...Fs>
+    void fork_join(Executor& executor, Fs&...fs) {
+        std::atomic<std::size_t> remaining(sizeof...(Fs));
+        std::tuple<ForkTask<Fs>...> tasks{ForkTask<Fs>(fs, remaining)...};
+        fork_join_impl(executor, tasks, remaining, std::index_sequence_for<Fs...>{});
+    }
+}
+
+// Like Serial but the matching handlers run concurrently, fork-join style, on an executor
+// (Executor::shared() by default) and the caller's thread. Returns once every handler is
+// done. Since they run at the same time every handler, the last one included, only gets
+// a const EventT&, and they must be safe to run concurrently on the same ctx. Handlers
+// aren't guaranteed a thread each, so they must not wait on one another.
+//
+// Worth it for independent handlers that each do a lot of work, the wall clock time is
+// then that of the slowest handler instead of the sum of all of them.
+template<typename ...HandlerTs>
+class Parallel {
+public:
+    Parallel(HandlerTs...handlers): Parallel(Executor::shared(), std::move(handlers)...) {}
+
+    Parallel(Executor& executor, HandlerTs...handlers): handlers(std::move(handlers)...), executor(&executor) {}
+
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<(count_dispatch_match<std::tuple<CtxT&, EventT>, HandlerTs...>() > 0)>>
+    void operator() (CtxT& ctx, EventT&& event) {
+        run(ctx, static_cast<const EventT&>(event), dispatch_match_indices<std::tuple<CtxT&, EventT>, HandlerTs...>());
+    }
+
+    template<typename CtxT>
+    void operator() (CtxT&, NoHandlerError) = delete;
+private:
+    HandlerTuple<HandlerTs...> handlers;
+    Executor* executor;
+
+    template<typename CtxT, typename EventT, std::size_t...Is>
+    void run(CtxT& ctx, const EventT& event, std::index_sequence<Is...>) {
+        if constexpr (sizeof...(Is) == 1) {
+            (get_handler<Is>(handlers)(ctx, event), ...);
+        } else {
+            auto calls = std::make_tuple([&]{get_handler<Is>(handlers)(ctx, event);}...);
+            std::apply([&](auto&...fs){detail::fork_join(*executor, fs...);}, calls);
+        }
+    }
+};
+
+template<typename...HandlerTs>
+Parallel(HandlerTs...) -> Parallel<HandlerTs...>;
+
+template<typename...HandlerTs>
+Parallel(Executor&, HandlerTs...) -> Parallel<HandlerTs...>;
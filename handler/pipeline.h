@@ -0,0 +1,298 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "meta.h"
+#include "completion.h"
+#include "future.h"
+#include "queue_limits.h"
+#include "buffered.h"
+
+struct PipelineStageStats {
+    std::uint64_t handled = 0;
+    // Events whose stage handler threw, they go no further down the pipeline.
+    std::uint64_t failed = 0;
+    // Events waiting in the stage's input ring.
+    std::uint64_t queued = 0;
+    // Time spent in the stage's handler.
+    std::chrono::nanoseconds busy{0};
+    // busy as a fraction of the pipeline's lifetime. The stage closest to 1 is the
+    // bottleneck, the stages after it are starved and the ones before it back up.
+    double occupancy = 0.0;
+};
+
+namespace detail {
+    template<bool Callable, typename CtxT, typename EventT, typename...StageTs>
+    struct PipelineStep {
+        static constexpr bool valid = false;
+        using output_t = void;
+    };
+
+    // What comes out of the last stage for an EventT going into the first, valid if every
+    // stage takes what the one before it returns.
+    template<typename CtxT, typename EventT, typename...StageTs>
+    struct PipelineChain {
+        static constexpr bool valid = true;
+        using output_t = EventT;
+    };
+
+    template<typename CtxT, typename EventT, typename StageT, typename...RestTs>
+    struct PipelineChain<CtxT, EventT, StageT, RestTs...>:
+        PipelineStep<can_call<StageT&, CtxT&, EventT&&>::value, CtxT, EventT, StageT, RestTs...> {};
+
+    template<typename CtxT, typename EventT, typename StageT, typename...RestTs>
+    struct PipelineStep<true, CtxT, EventT, StageT, RestTs...> {
+        using stage_output_t = std::decay_t<decltype(std::declval<StageT&>()(std::declval<CtxT&>(), std::declval<EventT&&>()))>;
+        // Only the last stage may return void, there would be nothing to pass on.
+        using next = std::conditional_t<
+            std::is_void_v<stage_output_t> && sizeof...(RestTs) != 0,
+            PipelineStep<false, CtxT, EventT>,
+            PipelineChain<CtxT, stage_output_t, RestTs...>
+        >;
+
+        static constexpr bool valid = next::valid;
+        using output_t = typename next::output_t;
+    };
+
+    // Events a stage's input ring holds before the stage feeding it waits for room.
+    inline constexpr std::size_t pipeline_ring_jobs = 1024;
+
+    // The stage thread's counters are on a different cache line from the producer's.
+    struct PipelineCounters {
+        alignas(cache_line) std::atomic<std::uint64_t> pushed{0};
+        alignas(cache_line) std::atomic<std::uint64_t> handled{0};
+        std::atomic<std::uint64_t> failed{0};
+        std::atomic<std::int64_t> busy_ns{0};
+    };
+
+    template<typename StateT, std::size_t I, typename CtxT, typename EventT, typename SinkT>
+    struct PipelineJob {
+        using Clock = std::chrono::steady_clock;
+
+        StateT* state;
+        CtxT* ctx;
+        EventT event;
+        SinkT result;
+
+        void operator()() {
+            auto start = Clock::now();
+            run(start);
+        }
+
+        // Consecutive events share their clock reads, two per event plus one.
+        static constexpr bool batchable = true;
+        static void run_batch(PipelineJob** jobs, std::size_t count) {
+            auto start = Clock::now();
+            for (std::size_t i = 0; i < count; i++) {
+                jobs[i]->run(start);
+            }
+        }
+
+        // The event is counted before it's handed on, so once a result is in the
+        // stats of every stage it went through include it. Handing it on isn't busy
+        // time: waiting for room in the next stage's ring would make every stage before
+        // the bottleneck look busy too, and the last stage's result runs continuations.
+        void run(Clock::time_point& start) {
+            try {
+                auto& stage = std::get<I>(state->stages);
+                if constexpr (I + 1 < StateT::stage_count) {
+                    auto output = stage(*ctx, std::move(event));
+                    state->record(I, true, start);
+                    state->template push<I + 1>(*ctx, std::move(output), std::move(result));
+                } else if constexpr (std::is_void_v<decltype(stage(*ctx, std::move(event)))>) {
+                    stage(*ctx, std::move(event));
+                    state->record(I, true, start);
+                    result.run([]{});
+                } else {
+                    auto output = stage(*ctx, std::move(event));
+                    state->record(I, true, start);
+                    result.run([&]{return std::move(output);});
+                }
+            } catch (...) {
+                state->record(I, false, start);
+                result.fail(std::current_exception());
+            }
+            start = Clock::now();
+        }
+    };
+
+    template<typename...StageTs>
+    class PipelineState {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr std::size_t stage_count = sizeof...(StageTs);
+
+        PipelineState(const std::vector<WorkerOptions>& options, StageTs...stages):
+            stages(std::move(stages)...),
+            started(Clock::now()),
+            first(make_worker<Producers::Multi>(options, 0)),
+            rest(make_rest(options, std::make_index_sequence<stage_count - 1>{}))
+            {}
+
+        // Stops the stages front to back, so a stage that is still running can hand
+        // its output on to the next one. Whatever is left queued is dropped.
+        ~PipelineState() {
+            first.reset();
+            for (auto& worker: rest) {
+                worker.reset();
+            }
+        }
+
+        template<std::size_t I, typename CtxT, typename EventT, typename SinkT>
+        void push(CtxT& ctx, EventT&& event, SinkT&& result) {
+            using JobT = PipelineJob<PipelineState, I, CtxT, remove_cvref_t<EventT>, remove_cvref_t<SinkT>>;
+            counters[I].pushed.fetch_add(1, std::memory_order_relaxed);
+            // Blocks while the ring is full, never sheds.
+            worker<I>().template admit<JobT>(0);
+            worker<I>().push(JobT{this, &ctx, std::forward<EventT>(event), std::forward<SinkT>(result)}, 0);
+        }
+
+        // Adds the time since start to the stage's busy time. Stage I's thread only.
+        void record(std::size_t stage, bool handled, Clock::time_point start) {
+            auto& c = counters[stage];
+            auto now = Clock::now();
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+            c.busy_ns.store(c.busy_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+            auto& count = handled ? c.handled : c.failed;
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        PipelineStageStats stats(std::size_t stage) const {
+            PipelineStageStats s;
+            if (stage >= stage_count) {
+                return s;
+            }
+            auto& c = counters[stage];
+            s.handled = c.handled.load(std::memory_order_acquire);
+            s.failed = c.failed.load(std::memory_order_acquire);
+            std::uint64_t pushed = c.pushed.load(std::memory_order_relaxed);
+            s.queued = pushed > s.handled + s.failed ? pushed - s.handled - s.failed : 0;
+            s.busy = std::chrono::nanoseconds(c.busy_ns.load(std::memory_order_relaxed));
+            auto lifetime = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started);
+            if (lifetime.count() > 0) {
+                s.occupancy = static_cast<double>(s.busy.count()) / static_cast<double>(lifetime.count());
+            }
+            return s;
+        }
+
+        std::tuple<StageTs...> stages;
+
+    private:
+        template<Producers P>
+        static std::unique_ptr<Worker<P>> make_worker(const std::vector<WorkerOptions>& options, std::size_t stage) {
+            return std::make_unique<Worker<P>>(QueueLimits{pipeline_ring_jobs, 0, Overflow::Block}, nullptr, std::nullopt, stage < options.size() ? options[stage] : WorkerOptions{});
+        }
+
+        template<std::size_t...Is>
+        static std::array<std::unique_ptr<Worker<Producers::Single>>, stage_count - 1> make_rest(const std::vector<WorkerOptions>& options, std::index_sequence<Is...>) {
+            return {make_worker<Producers::Single>(options, Is + 1)...};
+        }
+
+        template<std::size_t I>
+        auto& worker() {
+            if constexpr (I == 0) {
+                return *first;
+            } else {
+                return *rest[I - 1];
+            }
+        }
+
+        Clock::time_point started;
+        std::array<PipelineCounters, stage_count> counters;
+        // Events can come from any thread, after that each ring has the stage before it
+        // as its only producer.
+        std::unique_ptr<Worker<Producers::Multi>> first;
+        std::array<std::unique_ptr<Worker<Producers::Single>>, stage_count - 1> rest;
+    };
+}
+
+// Runs each stage on a thread of its own, with what a stage returns becoming the event
+// for the next one, so the stages of consecutive events overlap across cores instead of
+// one thread running them all back to back.
+//
+//     auto handler = Pipeline{
+//         [](Ctx& ctx, Packet packet){return decode(packet);},
+//         [](Ctx& ctx, Message message){return transform(message);},
+//         [](Ctx& ctx, Update update){ctx.apply(update);},
+//     };
+//
+// Stages are called with (Ctx&, EventT) and must return the next stage's event, only the
+// last one may return void. Every event goes through the stages in the order it was
+// posted, on the same ctx. Stages are linked by bounded rings like Buffered's, single
+// producer after the first, and a stage whose next ring is full waits for room, so a
+// slow stage backs the stages before it up rather than letting its queue grow. An
+// exception from a stage drops the event there and is passed on to its submit or async
+// caller.
+//
+// stats(i) gives each stage's occupancy, the fraction of time it spends in its handler,
+// which points to the stage to split or speed up. Given WorkerOptions, the ith applies to
+// the ith stage's thread, so stages can be pinned to cores of their own.
+template<typename...StageTs>
+class Pipeline {
+    static_assert(sizeof...(StageTs) > 0, "Pipeline needs at least one stage");
+
+public:
+    template<typename CtxT, typename EventT>
+    static constexpr bool accepts_v = detail::PipelineChain<CtxT, remove_cvref_t<EventT>, StageTs...>::valid;
+
+    // What the last stage returns.
+    template<typename CtxT, typename EventT>
+    using result_t = typename detail::PipelineChain<CtxT, remove_cvref_t<EventT>, StageTs...>::output_t;
+
+    Pipeline(StageTs...stages):
+        state(std::make_unique<detail::PipelineState<StageTs...>>(std::vector<WorkerOptions>{}, std::move(stages)...))
+        {}
+
+    // Throws std::system_error if a stage's thread can't be pinned or named.
+    Pipeline(std::vector<WorkerOptions> options, StageTs...stages):
+        state(std::make_unique<detail::PipelineState<StageTs...>>(options, std::move(stages)...))
+        {}
+
+    // Fire and forget, exceptions from the stages are only counted in stats.
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    void operator()(CtxT& ctx, EventT event) {
+        state->template push<0>(ctx, std::move(event), detail::DiscardResult{});
+    }
+
+    // Delivers the last stage's result to completion, which must stay alive until it is ready.
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    void submit(CtxT& ctx, EventT event, Completion<result_t<CtxT, EventT>>& completion) {
+        using ResultT = result_t<CtxT, EventT>;
+        state->template push<0>(ctx, std::move(event), detail::CompletionResult<ResultT>{detail::CompletionHandle<ResultT>(completion)});
+    }
+
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    Future<result_t<CtxT, EventT>> async(CtxT& ctx, EventT event) {
+        using ResultT = result_t<CtxT, EventT>;
+        auto* future_state = new detail::FutureState<ResultT>();
+        future_state->add_ref();
+        Future<ResultT> future(future_state);
+        state->template push<0>(ctx, std::move(event), detail::FutureResult<ResultT>(future_state));
+        return future;
+    }
+
+    PipelineStageStats stats(std::size_t stage) const {return state->stats(stage);}
+
+    static constexpr std::size_t stage_count() {return sizeof...(StageTs);}
+
+private:
+    std::unique_ptr<detail::PipelineState<StageTs...>> state;
+};
+
+template<typename...StageTs>
+Pipeline(StageTs...) -> Pipeline<StageTs...>;
+
+template<typename...StageTs>
+Pipeline(std::vector<WorkerOptions>, StageTs...) -> Pipeline<StageTs...>;
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <thread>
+
+namespace detail {
+    // Thread safe free list of fixed size blocks. Blocks are never given back to the
+    // system, so once a program reaches its peak number of live blocks allocating
+    // from the pool doesn't call operator new any more.
+    class BlockPool {
+    public:
+        static constexpr std::size_t block_size = 128;
+
+        BlockPool() = default;
+        BlockPool(const BlockPool&) = delete;
+        BlockPool& operator=(const BlockPool&) = delete;
+
+        void* allocate(std::size_t bytes) {
+            if (bytes > block_size) {
+                return ::operator new(bytes);
+            }
+            {
+                Lock lock(locked);
+                if (free_list) {
+                    FreeBlock* block = free_list;
+                    free_list = block->next;
+                    return block;
+                }
+            }
+            return ::operator new(block_size);
+        }
+
+        void deallocate(void* p, std::size_t bytes) {
+            if (bytes > block_size) {
+                ::operator delete(p);
+                return;
+            }
+            Lock lock(locked);
+            free_list = new (p) FreeBlock{free_list};
+        }
+
+    private:
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+        // The critical sections are a couple of pointer moves, a spin lock
+        // is cheaper than a mutex here.
+        struct Lock {
+            Lock(std::atomic_flag& flag): flag(flag) {
+                while (flag.test_and_set(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+            }
+            ~Lock() {flag.clear(std::memory_order_release);}
+            std::atomic_flag& flag;
+        };
+
+        std::atomic_flag locked = ATOMIC_FLAG_INIT;
+        FreeBlock* free_list = nullptr;
+    };
+
+    // Shared by every Buffered. Futures can outlive the Buffered that made them so
+    // the pool has to outlive all of them, it is intentionally never destroyed.
+    inline BlockPool& shared_state_pool() {
+        static BlockPool* pool = new BlockPool;
+        return *pool;
+    }
+}
+
+// Allocator for std::promise shared state, see detail::shared_state_pool.
+template<typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        if constexpr (alignof(T) > alignof(std::max_align_t)) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+        } else {
+            return static_cast<T*>(detail::shared_state_pool().allocate(n * sizeof(T)));
+        }
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        if constexpr (alignof(T) > alignof(std::max_align_t)) {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+        } else {
+            detail::shared_state_pool().deallocate(p, n * sizeof(T));
+        }
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const {return true;}
+
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const {return false;}
+};
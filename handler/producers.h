@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+
+enum class Producers {
+    Single,
+    Multi,
+};
+
+// Tag used to pick the producer mode of a queue (or of something that owns one)
+// through a constructor argument, so class template argument deduction still works.
+template<Producers P>
+struct producers_t {};
+
+inline constexpr producers_t<Producers::Single> single_producer{};
+inline constexpr producers_t<Producers::Multi> multi_producer{};
+
+namespace detail {
+    // Assumed cache line size, used to keep hot atomics written by different threads apart.
+    inline constexpr std::size_t cache_line = 64;
+}
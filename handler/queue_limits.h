@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// What a Buffered does with an event that would take its queue over budget.
+enum class Overflow {
+    // The producer waits until the worker has made room.
+    Block,
+    // The new event is dropped, a future or Completion for it gets broken_promise.
+    DropNewest,
+    // The new event is queued and the worker drops the oldest queued events until
+    // the queue is back within budget, their futures get broken_promise. If the
+    // worker is stuck on a slow event the queue can hold up to twice its budget
+    // before producers have to wait.
+    DropOldest,
+    // The new event is dropped and a future or Completion for it fails with QueueFull
+    // straight away.
+    Reject,
+};
+
+// Budgets for the events waiting in a Buffered's queue, 0 means no limit. Bytes count
+// the space a job takes in the queue plus anything the event owns on the heap as
+// reported by owned_bytes.
+struct QueueLimits {
+    std::size_t max_jobs = 0;
+    std::size_t max_bytes = 0;
+    Overflow overflow = Overflow::DropNewest;
+
+    bool bounded() const {return max_jobs || max_bytes;}
+};
+
+// A snapshot of a Buffered's queue. The shed counters only ever go up.
+struct QueueStats {
+    std::size_t pending_jobs = 0;
+    std::size_t pending_bytes = 0;
+    std::uint64_t dropped_newest = 0;
+    std::uint64_t dropped_oldest = 0;
+    std::uint64_t rejected = 0;
+    // Number of times a producer had to wait for room under Overflow::Block.
+    std::uint64_t blocked = 0;
+
+    std::uint64_t shed() const {return dropped_newest + dropped_oldest + rejected;}
+};
+
+// How a Buffered with more than one priority lane picks the lane to run jobs from.
+enum class LaneScheduling {
+    // Always the most urgent lane that has jobs, up to PriorityLanes::batch jobs at a time.
+    Strict,
+    // Lanes take turns from the most urgent down, each running up to its weight in jobs.
+    WeightedFair,
+};
+
+// Splits a Buffered's queue into count lanes, lane count - 1 being the most urgent.
+// An event goes into the lane of its priority (see event_priority and Priority), lanes
+// beyond the last are clamped to it. Each lane is FIFO, events in different lanes can be
+// handled out of the order they were posted in.
+struct PriorityLanes {
+    std::size_t count = 1;
+    LaneScheduling scheduling = LaneScheduling::Strict;
+    // Jobs per turn for each lane under WeightedFair, from lane 0 up. Missing weights
+    // double each lane, 1, 2, 4 and so on.
+    std::vector<std::size_t> weights = {};
+    // Most jobs run from one lane under Strict before looking for more urgent ones again,
+    // which bounds how long an urgent event waits behind a batch of less urgent ones.
+    std::size_t batch = 8;
+    // Starvation protection under Strict: a lane that has jobs but was passed over this
+    // many times in a row runs next. 0 lets urgent lanes starve the others.
+    std::size_t starvation_limit = 64;
+
+    std::size_t weight(std::size_t lane) const {
+        return lane < weights.size() && weights[lane] ? weights[lane] : std::size_t(1) << std::min<std::size_t>(lane, 16);
+    }
+};
+
+// What a Buffered's worker thread does when its queue is empty. Producers only make a
+// syscall to wake the worker when it is parked, so the spinning strategies trade a core
+// for not paying the wakeup on the next event.
+enum class WaitStrategy {
+    // Sleeps on a condition variable straight away, wakeups take microseconds.
+    Park,
+    // Polls the queue WorkerOptions::spins times, then parks.
+    SpinPark,
+    // Polls the queue spins times, then keeps polling but yields the core in between.
+    SpinYield,
+    // Polls the queue until stopped, for a dedicated core. Never parks.
+    BusySpin,
+};
+
+// How a Buffered's own worker thread runs. Doesn't apply to a Buffered on an Executor.
+struct WorkerOptions {
+    WaitStrategy wait = WaitStrategy::Park;
+    std::uint32_t spins = 4096;
+    // CPU to pin the thread to, -1 leaves it to the OS. Linux only, ignored elsewhere.
+    int cpu = -1;
+    // Thread name for top, perf and debuggers, cut to 15 characters. Linux only.
+    std::string name;
+};
+
+// Priority of an event when posting doesn't give one. Specialise for event types that
+// should skip ahead of the rest, e.g. input or resize events.
+template<typename T>
+struct event_priority {
+    static constexpr unsigned value = 0;
+};
+
+// Priority for one post, submit or async call, overriding event_priority.
+struct Priority {
+    unsigned value;
+};
+
+class QueueFull: public std::runtime_error {
+public:
+    QueueFull(): std::runtime_error("Buffered queue is full") {}
+};
+
+// Heap memory owned by an event, counted against QueueLimits::max_bytes.
+// Specialise for event types that own significant memory.
+template<typename T>
+struct owned_bytes {
+    static std::size_t of(const T&) {return 0;}
+};
+
+template<typename CharT, typename TraitsT, typename AllocT>
+struct owned_bytes<std::basic_string<CharT, TraitsT, AllocT>> {
+    static std::size_t of(const std::basic_string<CharT, TraitsT, AllocT>& s) {
+        // short strings live inside the object
+        return s.capacity() > std::basic_string<CharT, TraitsT, AllocT>().capacity() ? (s.capacity() + 1) * sizeof(CharT) : 0;
+    }
+};
+
+template<typename T, typename AllocT>
+struct owned_bytes<std::vector<T, AllocT>> {
+    static std::size_t of(const std::vector<T, AllocT>& v) {
+        return v.capacity() * sizeof(T);
+    }
+};
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "meta.h"
+#include "buffered.h"
+
+// The types an EventRecorder records and an EventReplayer replays.
+template<typename...Ts>
+struct Events {};
+
+template<typename...Ts>
+struct Requests {};
+
+// Event logs are a LogHeader, the sizeof of each registered type as a uint32_t, then
+// records: a RecordHeader followed by the event's bytes. Everything is in the host's byte
+// order, logs are meant to be replayed by the same build that recorded them.
+namespace detail {
+    inline constexpr char event_log_magic[8] = {'E', 'V', 'T', 'L', 'O', 'G', '\0', '\1'};
+
+    struct LogHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t event_types;
+        std::uint32_t request_types;
+    };
+
+    struct RecordHeader {
+        // steady_clock nanoseconds, only the differences between records mean anything.
+        std::uint64_t time_ns;
+        // Index into the event types and then the request types.
+        std::uint32_t type;
+        std::uint32_t size;
+    };
+
+    template<typename T, typename...Ts>
+    constexpr std::uint32_t type_index() {
+        constexpr bool matches[] = {std::is_same_v<T, Ts>...};
+        for (std::uint32_t i = 0; i < sizeof...(Ts); i++) {
+            if (matches[i]) {
+                return i;
+            }
+        }
+        return sizeof...(Ts);
+    }
+
+    template<typename...EventTs, typename...RequestTs>
+    LogHeader make_log_header(Events<EventTs...>, Requests<RequestTs...>) {
+        LogHeader header{};
+        std::memcpy(header.magic, event_log_magic, sizeof(header.magic));
+        header.version = 1;
+        header.event_types = sizeof...(EventTs);
+        header.request_types = sizeof...(RequestTs);
+        return header;
+    }
+
+    // Where the recorder's worker appends records, written out in large blocks.
+    class RecordFile {
+    public:
+        static constexpr std::size_t block_size = 1 << 16;
+
+        explicit RecordFile(const std::string& path): fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) {
+            if (fd < 0) {
+                throw std::runtime_error("failed to open event log: " + path);
+            }
+            buffer.reserve(block_size);
+        }
+
+        ~RecordFile() {
+            flush();
+            ::close(fd);
+        }
+
+        RecordFile(const RecordFile&) = delete;
+        RecordFile& operator=(const RecordFile&) = delete;
+
+        void append(const void* data, std::size_t size) {
+            auto bytes = static_cast<const unsigned char*>(data);
+            buffer.insert(buffer.end(), bytes, bytes + size);
+            if (buffer.size() >= block_size) {
+                flush();
+            }
+        }
+
+        void flush() {
+            std::size_t done = 0;
+            while (done < buffer.size()) {
+                ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+                if (n < 0) {
+                    // Nowhere to report it from the worker, the log just ends early.
+                    break;
+                }
+                done += static_cast<std::size_t>(n);
+            }
+            buffer.clear();
+        }
+
+    private:
+        int fd;
+        std::vector<unsigned char> buffer;
+    };
+
+    template<typename EventT>
+    struct RecordEntry {
+        RecordHeader header;
+        EventT event;
+    };
+
+    struct FlushRecords {};
+
+    // The recorder's Buffered handler, runs on its worker.
+    struct RecordWriter {
+        template<typename EventT>
+        void operator()(RecordFile& file, const RecordEntry<EventT>& entry) {
+            file.append(&entry.header, sizeof(entry.header));
+            file.append(&entry.event, sizeof(EventT));
+        }
+
+        void operator()(RecordFile& file, FlushRecords) {
+            file.flush();
+        }
+    };
+
+    // What the recorder looks like from inside a handler tree.
+    template<typename RecorderT, bool Request>
+    class RecordTap {
+    public:
+        explicit RecordTap(RecorderT& recorder): recorder(&recorder) {}
+
+        template<typename CtxT, typename EventT, typename = std::enable_if_t<RecorderT::template records_v<EventT, Request>>>
+        void operator()(CtxT&, const EventT& event) {
+            if constexpr (Request) {
+                recorder->record_request(event);
+            } else {
+                recorder->record(event);
+            }
+        }
+
+    private:
+        RecorderT* recorder;
+    };
+}
+
+// Records a stream of events and requests to a compact binary log that EventReplayer can
+// feed back into a Ctx, to reproduce a performance problem offline.
+//
+//     EventRecorder<Events<Key, Resize>, Requests<Lookup>> recorder("session.evlog");
+//
+// Only the listed types are recorded, they have to be trivially copyable since they are
+// written out as raw bytes. events() and requests() are handlers to put first in the
+// Ctx's event Serial and request First, every event they see is stamped with
+// steady_clock and handed to a Buffered worker which appends it to the file in 64 KiB
+// writes, so recording costs the calling thread a clock read and a queue push. Records
+// reach the file when a block fills, on flush() and when the recorder is destroyed. The
+// recorder must outlive the handlers returned by events() and requests().
+template<typename EventsT, typename RequestsT = Requests<>>
+class EventRecorder;
+
+template<typename...EventTs, typename...RequestTs>
+class EventRecorder<Events<EventTs...>, Requests<RequestTs...>> {
+public:
+    static_assert(sizeof...(EventTs) + sizeof...(RequestTs) > 0, "EventRecorder needs at least one type to record");
+    static_assert((std::is_trivially_copyable_v<EventTs> && ...) && (std::is_trivially_copyable_v<RequestTs> && ...),
+        "EventRecorder can only record trivially copyable types");
+
+    template<typename T, bool Request = false>
+    static constexpr bool records_v = Request
+        ? detail::is_one_of_v<remove_cvref_t<T>, RequestTs...>
+        : detail::is_one_of_v<remove_cvref_t<T>, EventTs...>;
+
+    explicit EventRecorder(const std::string& path): file(path), writer(detail::RecordWriter{}) {
+        auto header = detail::make_log_header(Events<EventTs...>{}, Requests<RequestTs...>{});
+        file.append(&header, sizeof(header));
+        std::uint32_t sizes[] = {static_cast<std::uint32_t>(sizeof(EventTs))..., static_cast<std::uint32_t>(sizeof(RequestTs))...};
+        file.append(sizes, sizeof(sizes));
+    }
+
+    ~EventRecorder() {
+        // The worker drops whatever is still queued when it stops.
+        flush();
+    }
+
+    EventRecorder(const EventRecorder&) = delete;
+    EventRecorder& operator=(const EventRecorder&) = delete;
+
+    detail::RecordTap<EventRecorder, false> events() {return detail::RecordTap<EventRecorder, false>(*this);}
+    detail::RecordTap<EventRecorder, true> requests() {return detail::RecordTap<EventRecorder, true>(*this);}
+
+    template<typename EventT, typename = std::enable_if_t<records_v<EventT>>>
+    void record(const EventT& event) {
+        using T = remove_cvref_t<EventT>;
+        append(event, detail::type_index<T, EventTs...>());
+    }
+
+    template<typename RequestT, typename = std::enable_if_t<records_v<RequestT, true>>>
+    void record_request(const RequestT& request) {
+        using T = remove_cvref_t<RequestT>;
+        append(request, sizeof...(EventTs) + detail::type_index<T, RequestTs...>());
+    }
+
+    // Waits until everything recorded so far has been written to the file.
+    void flush() {
+        Completion<void> done;
+        writer.submit(file, detail::FlushRecords{}, done);
+        done.get();
+    }
+
+private:
+    detail::RecordFile file;
+    Buffered<detail::RecordWriter> writer;
+
+    template<typename T>
+    void append(const T& value, std::uint32_t type) {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        detail::RecordHeader header{
+            static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()),
+            type,
+            static_cast<std::uint32_t>(sizeof(T)),
+        };
+        writer.post(file, detail::RecordEntry<T>{header, value});
+    }
+};
+
+enum class ReplayTiming {
+    // Every record straight after the last.
+    AsFastAsPossible,
+    // Each record at the same offset from the first as when it was recorded.
+    Original,
+};
+
+// Maps an event log written by an EventRecorder with the same Events and Requests and
+// feeds it to a Ctx, events through ctx.handle_event and requests through
+// ctx.handle_request with the answer thrown away. Each record is copied out of the
+// mapping into a properly aligned object first. A log cut short, e.g. by a crash while
+// recording, replays up to its last whole record.
+template<typename EventsT, typename RequestsT = Requests<>>
+class EventReplayer;
+
+template<typename...EventTs, typename...RequestTs>
+class EventReplayer<Events<EventTs...>, Requests<RequestTs...>> {
+public:
+    static_assert(sizeof...(EventTs) + sizeof...(RequestTs) > 0, "EventReplayer needs at least one type to replay");
+    static_assert((std::is_trivially_copyable_v<EventTs> && ...) && (std::is_trivially_copyable_v<RequestTs> && ...),
+        "EventReplayer can only replay trivially copyable types");
+
+    explicit EventReplayer(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open event log: " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("failed to stat event log: " + path);
+        }
+        size = static_cast<std::size_t>(st.st_size);
+        if (size > 0) {
+            void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("failed to map event log: " + path);
+            }
+            data = static_cast<const unsigned char*>(p);
+            ::madvise(p, size, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+        // Unmaps on the way out if the header is rejected.
+        struct Unmap {
+            EventReplayer* self;
+            ~Unmap() {if (self) {self->unmap();}}
+        } unmap_on_error{this};
+        records_begin = check_header();
+        unmap_on_error.self = nullptr;
+    }
+
+    ~EventReplayer() {unmap();}
+
+    EventReplayer(const EventReplayer&) = delete;
+    EventReplayer& operator=(const EventReplayer&) = delete;
+
+    // Replays the whole log and returns the number of records replayed.
+    template<typename CtxT>
+    std::size_t replay(CtxT& ctx, ReplayTiming timing = ReplayTiming::AsFastAsPossible) {
+        using Fn = void(*)(CtxT&, const unsigned char*);
+        static constexpr Fn dispatch[] = {&deliver<CtxT, EventTs, false>..., &deliver<CtxT, RequestTs, true>...};
+
+        std::size_t count = 0;
+        std::uint64_t first_ns = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t pos = records_begin; pos + sizeof(detail::RecordHeader) <= size;) {
+            detail::RecordHeader header;
+            std::memcpy(&header, data + pos, sizeof(header));
+            pos += sizeof(header);
+            std::uint32_t type = header.type;
+            if (type >= type_count || header.size != sizes[type] || pos + header.size > size) {
+                break;
+            }
+
+            if (timing == ReplayTiming::Original) {
+                if (count == 0) {
+                    first_ns = header.time_ns;
+                }
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(header.time_ns - first_ns));
+            }
+            dispatch[type](ctx, data + pos);
+            pos += header.size;
+            count++;
+        }
+        return count;
+    }
+
+private:
+    const unsigned char* data = nullptr;
+    std::size_t size = 0;
+    std::size_t records_begin = 0;
+    static constexpr std::size_t type_count = sizeof...(EventTs) + sizeof...(RequestTs);
+    static constexpr std::uint32_t sizes[] = {static_cast<std::uint32_t>(sizeof(EventTs))..., static_cast<std::uint32_t>(sizeof(RequestTs))...};
+
+    template<typename CtxT, typename EventT, bool Request>
+    static void deliver(CtxT& ctx, const unsigned char* bytes) {
+        // Copying the bytes of a trivially copyable type makes the object, no default
+        // constructor needed.
+        alignas(EventT) unsigned char storage[sizeof(EventT)];
+        std::memcpy(storage, bytes, sizeof(EventT));
+        EventT& event = *std::launder(reinterpret_cast<EventT*>(storage));
+        if constexpr (Request) {
+            (void) ctx.handle_request(std::move(event));
+        } else {
+            ctx.handle_event(std::move(event));
+        }
+    }
+
+    std::size_t check_header() const {
+        detail::LogHeader header;
+        if (size < sizeof(header)) {
+            throw std::runtime_error("event log is too short");
+        }
+        std::memcpy(&header, data, sizeof(header));
+        auto expected = detail::make_log_header(Events<EventTs...>{}, Requests<RequestTs...>{});
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version) {
+            throw std::runtime_error("not an event log");
+        }
+        std::size_t begin = sizeof(header) + sizeof(sizes);
+        bool same_types = header.event_types == expected.event_types && header.request_types == expected.request_types;
+        if (!same_types || size < begin || std::memcmp(data + sizeof(header), sizes, sizeof(sizes)) != 0) {
+            throw std::runtime_error("event log was recorded with different event types");
+        }
+        return begin;
+    }
+
+    void unmap() {
+        if (data) {
+            ::munmap(const_cast<unsigned char*>(data), size);
+            data = nullptr;
+        }
+    }
+};
@@ -24,7 +24,7 @@ public:
         // forward the event to the last handler, the last handler is
         // allowed to do whatever it wants to event (e.g. move out of it).
         constexpr std::size_t last = dispatch_match_last<std::tuple<CtxT&, EventT>, HandlerTs...>();
-        std::get<last>(handlers)(ctx, std::forward<EventT>(event));
+        get_handler<last>(handlers)(ctx, std::forward<EventT>(event));
     }
 
     // unlike MustHandle this allows sfinae to account for a lack of handlers
@@ -32,5 +32,5 @@ public:
     template<typename CtxT>
     void operator() (CtxT&, NoHandlerError) = delete;
 private:
-    std::tuple<HandlerTs...> handlers;
+    HandlerTuple<HandlerTs...> handlers;
 };
\ No newline at end of file
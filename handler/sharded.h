@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "meta.h"
+#include "buffered.h"
+
+template<std::size_t N>
+struct shards_t {
+    static_assert(N > 0, "Sharded needs at least one shard");
+};
+
+template<std::size_t N>
+inline constexpr shards_t<N> shards{};
+
+// N Buffered workers, each event goes to the one its key hashes to. Events with the same
+// key are handled in the order they were posted, events with different keys may be
+// handled in parallel, so it scales across cores for work like per entity or per
+// connection streams that only needs ordering per key.
+//
+//     auto handler = Sharded{shards<4>, [](const Move& m){return m.entity;}, handler};
+//
+// Every shard gets its own copy of the handler, so the handler is called from N threads
+// but each copy only from one. The key function is called on the producer's thread and
+// its result is hashed with std::hash. QueueLimits apply to each shard on its own, given
+// an Executor the shards run as strands on the executor's threads instead of N threads.
+template<std::size_t N, typename KeyFnT, typename HandlerT>
+class Sharded {
+public:
+    Sharded(shards_t<N>, KeyFnT key_fn, HandlerT handler, QueueLimits limits = {}):
+        Sharded(std::move(key_fn), [&](){return Buffered<HandlerT>(handler, limits);}, std::make_index_sequence<N>{})
+        {}
+
+    Sharded(shards_t<N> tag, KeyFnT key_fn, HandlerT handler, Executor& executor):
+        Sharded(tag, std::move(key_fn), std::move(handler), QueueLimits{}, executor)
+        {}
+
+    Sharded(shards_t<N>, KeyFnT key_fn, HandlerT handler, QueueLimits limits, Executor& executor):
+        Sharded(std::move(key_fn), [&](){return Buffered<HandlerT>(handler, limits, executor);}, std::make_index_sequence<N>{})
+        {}
+
+    template<typename CtxT, typename EventT>
+    static constexpr bool accepts_v = Buffered<HandlerT>::template accepts_v<CtxT, EventT> && can_call<const KeyFnT&, const EventT&>::value;
+
+    // Same as Buffered::operator() on the event's shard.
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    auto operator()(CtxT& ctx, EventT event) {
+        return shard_of(event)(ctx, std::move(event));
+    }
+
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    bool post(CtxT& ctx, EventT event) {
+        return shard_of(event).post(ctx, std::move(event));
+    }
+
+    template<typename CtxT, typename EventT, typename ResultT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    void submit(CtxT& ctx, EventT event, Completion<ResultT>& completion) {
+        shard_of(event).submit(ctx, std::move(event), completion);
+    }
+
+    template<typename CtxT, typename EventT, typename = std::enable_if_t<accepts_v<CtxT, EventT>>>
+    auto async(CtxT& ctx, EventT event) {
+        return shard_of(event).async(ctx, std::move(event));
+    }
+
+    // Which shard events with this key go to.
+    template<typename KeyT>
+    static std::size_t shard_index(const KeyT& key) {
+        // std::hash of an integer is usually the integer itself, mix it so keys that are
+        // all multiples of N don't end up on one shard.
+        std::uint64_t h = static_cast<std::uint64_t>(std::hash<KeyT>{}(key)) * 0x9E3779B97F4A7C15ull;
+        return static_cast<std::size_t>((h >> 32) % N);
+    }
+
+    static constexpr std::size_t shard_count() {return N;}
+
+    QueueStats stats(std::size_t shard) const {return workers[shard].stats();}
+
+private:
+    template<typename MakeT, std::size_t...Is>
+    Sharded(KeyFnT key_fn, MakeT make, std::index_sequence<Is...>):
+        key_fn(std::move(key_fn)),
+        workers{((void)Is, make())...}
+        {}
+
+    template<typename EventT>
+    Buffered<HandlerT>& shard_of(const EventT& event) {
+        return workers[shard_index(key_fn(event))];
+    }
+
+    KeyFnT key_fn;
+    // Buffered can't be moved once it has jobs queued, so neither can Sharded.
+    std::array<Buffered<HandlerT>, N> workers;
+};
+
+template<std::size_t N, typename KeyFnT, typename HandlerT>
+Sharded(shards_t<N>, KeyFnT, HandlerT) -> Sharded<N, KeyFnT, HandlerT>;
+
+template<std::size_t N, typename KeyFnT, typename HandlerT>
+Sharded(shards_t<N>, KeyFnT, HandlerT, QueueLimits) -> Sharded<N, KeyFnT, HandlerT>;
+
+template<std::size_t N, typename KeyFnT, typename HandlerT>
+Sharded(shards_t<N>, KeyFnT, HandlerT, Executor&) -> Sharded<N, KeyFnT, HandlerT>;
+
+template<std::size_t N, typename KeyFnT, typename HandlerT>
+Sharded(shards_t<N>, KeyFnT, HandlerT, QueueLimits, Executor&) -> Sharded<N, KeyFnT, HandlerT>;
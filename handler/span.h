@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+
+// Minimal stand in for C++20's std::span, a view of count contiguous Ts.
+template<typename T>
+class Span {
+public:
+    constexpr Span(): data_(nullptr), size_(0) {}
+    constexpr Span(T* data, std::size_t size): data_(data), size_(size) {}
+
+    constexpr T* data() const {return data_;}
+    constexpr std::size_t size() const {return size_;}
+    constexpr bool empty() const {return size_ == 0;}
+
+    constexpr T& operator[](std::size_t i) const {return data_[i];}
+    constexpr T& front() const {return data_[0];}
+    constexpr T& back() const {return data_[size_ - 1];}
+
+    constexpr T* begin() const {return data_;}
+    constexpr T* end() const {return data_ + size_;}
+
+private:
+    T* data_;
+    std::size_t size_;
+};
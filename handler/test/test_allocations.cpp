@@ -0,0 +1,130 @@
+#include <atomic>
+#include <cstdlib>
+#include <future>
+#include <new>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/broadcast.h"
+#include "event/buffered.h"
+#include "event/frame_arena.h"
+
+// Counts the allocations made by each thread so tests can check hot paths don't
+// allocate. Only the test's own thread is looked at, so worker threads that other
+// tests left behind can't throw the counts off. This replaces the global operator new,
+// which is why the tests are a binary of their own.
+namespace {
+    thread_local std::size_t allocations = 0;
+
+    void* allocate(std::size_t size) {
+        allocations++;
+        if (void* p = std::malloc(size ? size : 1)) {
+            return p;
+        }
+        throw std::bad_alloc();
+    }
+
+    // Kept out of line so the compiler can't pair the free with an inlined new.
+    [[gnu::noinline]] void deallocate(void* p) noexcept {
+        std::free(p);
+    }
+}
+
+void* operator new(std::size_t size) {return allocate(size);}
+void* operator new[](std::size_t size) {return allocate(size);}
+
+void operator delete(void* p) noexcept {deallocate(p);}
+void operator delete[](void* p) noexcept {deallocate(p);}
+void operator delete(void* p, std::size_t) noexcept {deallocate(p);}
+void operator delete[](void* p, std::size_t) noexcept {deallocate(p);}
+
+TEST(TestAllocations, buffered_steady_state) {
+    int ctx = 0;
+    auto handler = Buffered {
+        [](int& ctx, int event){return event + 1;},
+    };
+
+    constexpr int events = 100;
+    std::vector<std::future<int>> futures;
+    futures.reserve(events);
+
+    // warm up, lets the shared state pool reach its peak size
+    for (int i = 0; i < events; i++) {
+        futures.push_back(handler(ctx, i));
+    }
+    for (auto& future: futures) {
+        future.get();
+    }
+    futures.clear();
+
+    std::size_t before = allocations;
+    for (int i = 0; i < events; i++) {
+        futures.push_back(handler(ctx, i));
+    }
+    for (int i = 0; i < events; i++) {
+        ASSERT_EQ(futures[i].get(), i + 1);
+    }
+    ASSERT_EQ(allocations - before, 0u);
+}
+
+TEST(TestAllocations, buffered_post_and_submit) {
+    int ctx = 0;
+    auto handler = Buffered {
+        [](int& ctx, int event){return event + 1;},
+    };
+
+    Completion<int> completion;
+    handler.submit(ctx, 0, completion);
+    completion.get();
+
+    std::size_t before = allocations;
+    for (int i = 0; i < 100; i++) {
+        handler.post(ctx, i);
+    }
+    handler.submit(ctx, 1, completion);
+    ASSERT_EQ(completion.get(), 2);
+    ASSERT_EQ(allocations - before, 0u);
+}
+
+TEST(TestAllocations, frame_arena_events) {
+    int ctx = 0;
+    FrameArena arena;
+    std::size_t total = 0;
+    auto handler = Buffered {
+        [&](int& ctx, FrameString s){total += s.size();},
+    };
+    // Longer than any small string buffer, as a std::string every event would allocate.
+    std::string text(100, 'x');
+
+    Completion<void> completion;
+    handler.submit(ctx, arena.copy(text), completion);
+    completion.get();
+    arena.end_frame();
+
+    std::size_t before = allocations;
+    for (int frame = 0; frame < 10; frame++) {
+        for (int i = 0; i < 100; i++) {
+            handler.post(ctx, arena.copy(text));
+        }
+        handler.submit(ctx, arena.copy(text), completion);
+        completion.get();
+        arena.end_frame();
+    }
+    ASSERT_EQ(allocations - before, 0u);
+    ASSERT_EQ(total, 100u + 10 * 101 * 100);
+}
+
+TEST(TestAllocations, broadcast_fan_out) {
+    int ctx = 0;
+    std::atomic<int> handled{0};
+    auto consumer = [&](int& ctx, const int& event){handled++;};
+    auto handler = Broadcast{consumer, consumer, consumer, consumer};
+
+    std::size_t before = allocations;
+    for (int i = 0; i < 100; i++) {
+        handler(ctx, i);
+    }
+    handler.drain();
+    ASSERT_EQ(allocations - before, 0u);
+    ASSERT_EQ(handled, 400);
+}
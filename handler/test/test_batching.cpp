@@ -0,0 +1,189 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/batching.h"
+#include "event/first.h"
+
+namespace {
+    struct Lookup {
+        int id;
+    };
+
+    struct Upload {
+        int bytes;
+    };
+
+    constexpr auto forever = std::chrono::hours(1);
+}
+
+TEST(TestBatching, sends_full_batches) {
+    std::mutex mutex;
+    std::vector<std::size_t> sizes;
+    auto handler = Batching{4, forever, [&](int& ctx, Span<const Lookup> lookups){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sizes.push_back(lookups.size());
+        }
+        std::vector<int> results;
+        for (auto& lookup: lookups) {
+            results.push_back(lookup.id * 2);
+        }
+        return results;
+    }};
+
+    int ctx = 0;
+    std::vector<Future<int>> futures;
+    for (int i = 0; i < 8; i++) {
+        futures.push_back(handler.async(ctx, Lookup{i}));
+    }
+    for (int i = 0; i < 8; i++) {
+        ASSERT_EQ(futures[i].get(), i * 2);
+    }
+    ASSERT_EQ(sizes, (std::vector<std::size_t>{4, 4}));
+
+    auto stats = handler.stats();
+    ASSERT_EQ(stats.batches, 2u);
+    ASSERT_EQ(stats.requests, 8u);
+    ASSERT_EQ(stats.full_batches, 2u);
+}
+
+TEST(TestBatching, sends_partial_batches_after_max_delay) {
+    auto max_delay = std::chrono::milliseconds(5);
+    auto handler = First {
+        Batching{100, max_delay, [](int& ctx, Span<const Lookup> lookups){
+            return std::vector<int>(lookups.size(), static_cast<int>(lookups.size()));
+        }},
+    };
+
+    int ctx = 0;
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(handler(ctx, Lookup{1}), 1);
+    ASSERT_GE(std::chrono::steady_clock::now() - start, max_delay);
+}
+
+TEST(TestBatching, blocked_callers_wake_with_their_batch) {
+    // Long enough that a backing off waiter is down to its longest sleeps.
+    auto batch_time = std::chrono::milliseconds(3);
+    std::atomic<std::chrono::steady_clock::rep> finished{0};
+    auto handler = Batching{1, forever, [&](int& ctx, Span<const Lookup> lookups){
+        std::this_thread::sleep_for(batch_time);
+        finished = std::chrono::steady_clock::now().time_since_epoch().count();
+        return std::vector<int>(lookups.size(), 0);
+    }};
+
+    int ctx = 0;
+    constexpr int calls = 20;
+    std::chrono::steady_clock::duration late{0};
+    for (int i = 0; i < calls; i++) {
+        handler(ctx, Lookup{i});
+        late += std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(finished.load());
+    }
+    ASSERT_LT(std::chrono::duration_cast<std::chrono::microseconds>(late / calls).count(), 150);
+}
+
+TEST(TestBatching, leftovers_keep_their_clock) {
+    auto max_delay = std::chrono::milliseconds(150);
+    auto handler = Batching{4, max_delay, [](int& ctx, Span<const Lookup> lookups){
+        if (lookups[0].id == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        return std::vector<int>(lookups.size(), static_cast<int>(lookups.size()));
+    }};
+
+    int ctx = 0;
+    std::vector<Future<int>> futures;
+    for (int i = 0; i < 4; i++) {
+        futures.push_back(handler.async(ctx, Lookup{i}));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // A full batch and one left over, all queued while the first batch runs.
+    auto queued = std::chrono::steady_clock::now();
+    for (int i = 4; i < 9; i++) {
+        futures.push_back(handler.async(ctx, Lookup{i}));
+    }
+    ASSERT_EQ(futures[8].get(), 1);
+    // Its max_delay ran out while it waited behind the first batch, so it goes straight
+    // after the second rather than max_delay after that.
+    ASSERT_LT(std::chrono::steady_clock::now() - queued, std::chrono::milliseconds(200) + max_delay / 2);
+    ASSERT_EQ(handler.stats().batches, 3u);
+}
+
+TEST(TestBatching, routes_results_to_their_callers) {
+    constexpr int threads = 4;
+    constexpr int requests = 200;
+    auto handler = First {
+        Batching{16, std::chrono::microseconds(200), [](int& ctx, Span<const Lookup> lookups){
+            std::vector<int> results;
+            for (auto& lookup: lookups) {
+                results.push_back(lookup.id + 1000);
+            }
+            return results;
+        }},
+    };
+
+    int ctx = 0;
+    std::atomic<int> wrong{0};
+    std::vector<std::thread> callers;
+    for (int t = 0; t < threads; t++) {
+        callers.emplace_back([&, t]{
+            for (int i = 0; i < requests; i++) {
+                int id = t * requests + i;
+                if (handler(ctx, Lookup{id}) != id + 1000) {
+                    wrong++;
+                }
+            }
+        });
+    }
+    for (auto& caller: callers) {
+        caller.join();
+    }
+    ASSERT_EQ(wrong, 0);
+}
+
+TEST(TestBatching, errors_reach_every_request) {
+    auto throwing = Batching{2, forever, [](int& ctx, Span<const Lookup>) -> std::vector<int> {
+        throw std::runtime_error("backend down");
+    }};
+    auto short_answer = Batching{2, forever, [](int& ctx, Span<const Lookup>){
+        return std::vector<int>(1);
+    }};
+
+    int ctx = 0;
+    auto a = throwing.async(ctx, Lookup{1});
+    auto b = throwing.async(ctx, Lookup{2});
+    ASSERT_THROW(a.get(), std::runtime_error);
+    ASSERT_THROW(b.get(), std::runtime_error);
+
+    Completion<int> c;
+    Completion<int> d;
+    short_answer.submit(ctx, Lookup{1}, c);
+    short_answer.submit(ctx, Lookup{2}, d);
+    ASSERT_THROW(c.get(), BatchSizeMismatch);
+    ASSERT_THROW(d.get(), BatchSizeMismatch);
+}
+
+TEST(TestBatching, void_batches_and_shutdown) {
+    std::atomic<int> uploaded{0};
+    std::vector<Future<void>> futures;
+    int ctx = 0;
+    {
+        auto handler = Batching{64, forever, [&](int& ctx, Span<const Upload> uploads){
+            for (auto& upload: uploads) {
+                uploaded += upload.bytes;
+            }
+        }};
+        for (int i = 0; i < 3; i++) {
+            futures.push_back(handler.async(ctx, Upload{10}));
+        }
+        // Destroying it sends what is still waiting.
+    }
+    for (auto& future: futures) {
+        future.get();
+    }
+    ASSERT_EQ(uploaded, 30);
+}
@@ -0,0 +1,115 @@
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/broadcast.h"
+
+namespace {
+    struct Tick {
+        int seq;
+    };
+
+    // Counts the copies and moves made of it.
+    struct Counted {
+        static inline std::atomic<int> copies{0};
+
+        int seq;
+        std::string payload;
+
+        Counted(int seq, std::string payload): seq(seq), payload(std::move(payload)) {}
+        Counted(const Counted& other): seq(other.seq), payload(other.payload) {copies++;}
+        Counted(Counted&& other): seq(other.seq), payload(std::move(other.payload)) {copies++;}
+    };
+}
+
+TEST(TestBroadcast, every_consumer_reads_in_place) {
+    constexpr int kEvents = 1000;
+    std::mutex mutex;
+    std::vector<std::vector<int>> seen(3);
+    std::vector<std::vector<const Tick*>> addresses(3);
+    std::set<std::thread::id> threads;
+    auto consumer = [&](std::size_t i){
+        return [&, i](int& ctx, const Tick& tick){
+            std::lock_guard<std::mutex> lock(mutex);
+            seen[i].push_back(tick.seq);
+            addresses[i].push_back(&tick);
+            threads.insert(std::this_thread::get_id());
+        };
+    };
+    auto handler = Broadcast{consumer(0), consumer(1), consumer(2)};
+
+    int ctx = 0;
+    for (int i = 0; i < kEvents; i++) {
+        handler(ctx, Tick{i});
+    }
+    handler.drain();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (std::size_t i = 0; i < 3; i++) {
+        ASSERT_EQ(seen[i].size(), std::size_t(kEvents));
+        for (int seq = 0; seq < kEvents; seq++) {
+            ASSERT_EQ(seen[i][seq], seq);
+        }
+        ASSERT_EQ(addresses[i], addresses[0]);
+        ASSERT_EQ(handler.lag(i), 0u);
+    }
+    ASSERT_EQ(threads.size(), 3u);
+    ASSERT_EQ(handler.published(), std::uint64_t(kEvents));
+}
+
+TEST(TestBroadcast, copies_independent_of_consumers) {
+    constexpr int kEvents = 100;
+    std::atomic<int> handled{0};
+    auto consumer = [&](int& ctx, const Counted& event){handled++;};
+
+    auto copies_with = [&](auto handler){
+        Counted::copies = 0;
+        int ctx = 0;
+        for (int i = 0; i < kEvents; i++) {
+            // Boxed, it doesn't fit in a slot.
+            handler(ctx, Counted{i, std::string(100, 'x')});
+        }
+        handler.drain();
+        return Counted::copies.load();
+    };
+
+    int one = copies_with(Broadcast{consumer});
+    int four = copies_with(Broadcast{consumer, consumer, consumer, consumer});
+    ASSERT_EQ(one, four);
+    ASSERT_EQ(handled, 5 * kEvents);
+}
+
+TEST(TestBroadcast, slowest_consumer_gates_producer) {
+    constexpr int kEvents = 200;
+    std::atomic<int> fast{0};
+    std::atomic<int> slow{0};
+    std::atomic<int> strings{0};
+    auto handler = Broadcast {
+        BroadcastCapacity{8},
+        [&](int& ctx, const Tick& tick){fast++;},
+        [&](int& ctx, const Tick& tick){
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            slow++;
+        },
+        // Skips the Ticks.
+        [&](int& ctx, const std::string& s){strings++;},
+    };
+    ASSERT_EQ(handler.capacity_slots(), 8u);
+
+    int ctx = 0;
+    for (int i = 0; i < kEvents; i++) {
+        handler(ctx, Tick{i});
+        ASSERT_LE(handler.lag(1), handler.capacity_slots());
+    }
+    handler(ctx, std::string("done"));
+    handler.drain();
+
+    ASSERT_EQ(fast, kEvents);
+    ASSERT_EQ(slow, kEvents);
+    ASSERT_EQ(strings, 1);
+    ASSERT_GT(handler.producer_waits(), 0u);
+}
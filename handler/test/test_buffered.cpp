@@ -0,0 +1,748 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/buffered.h"
+#include "event/serial.h"
+
+template<typename T>
+struct is_single_producer: std::false_type {};
+
+template<typename HandlerT>
+struct is_single_producer<Buffered<HandlerT, Producers::Single>>: std::true_type {};
+
+
+TEST(TestBuffered, runs_handler) {
+    int ctx = 0;
+    auto handler = Buffered {
+        [](int& ctx, std::string event){return event.size();},
+    };
+    auto future = handler(ctx, std::string("hello"));
+    ASSERT_EQ(future.get(), 5u);
+}
+
+TEST(TestBuffered, single_producer_keeps_order) {
+    std::vector<int> seen;
+    auto handler = Buffered {
+        [&seen](int& ctx, int event){seen.push_back(event);},
+        4,
+        single_producer,
+    };
+    static_assert(is_single_producer<decltype(handler)>::value, "");
+
+    int ctx = 0;
+    for (int i = 0; i < 3; i++) {
+        handler(ctx, i);
+    }
+    Completion<void> done;
+    handler.submit(ctx, 3, done);
+    done.get();
+    ASSERT_EQ(seen, (std::vector<int>{0, 1, 2, 3}));
+}
+
+TEST(TestBuffered, multi_producer) {
+    constexpr int producers = 4;
+    constexpr int per_producer = 1000;
+    std::atomic<int> total{0};
+    auto handler = Buffered {
+        [&total](int& ctx, int event){total += event;},
+    };
+
+    int ctx = 0;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&]{
+            for (int i = 0; i < per_producer; i++) {
+                handler(ctx, 1);
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    Completion<void> done;
+    handler.submit(ctx, 0, done);
+    done.get();
+    ASSERT_EQ(total.load(), producers * per_producer);
+}
+
+TEST(TestBuffered, handler_posts_past_a_full_ring) {
+    // Far more than the ring holds, all posted from the worker thread itself.
+    constexpr int reposts = 5000;
+    std::vector<int> seen;
+    std::atomic<int> handled{0};
+    std::function<void(int&, int)> repost;
+    auto handler = Buffered {
+        [&](int& ctx, int event){
+            seen.push_back(event);
+            if (event == 0) {
+                for (int i = 1; i <= reposts; i++) {
+                    repost(ctx, i);
+                }
+            }
+            handled++;
+        },
+    };
+    repost = [&](int& ctx, int event){handler.post(ctx, event);};
+
+    int ctx = 0;
+    handler.post(ctx, 0);
+    for (int i = reposts + 1; i <= reposts + 100; i++) {
+        handler.post(ctx, i);
+    }
+    while (handled < reposts + 101) {
+        std::this_thread::yield();
+    }
+
+    // The worker's own posts keep their order, and so do the main thread's.
+    std::vector<int> reposted;
+    std::vector<int> posted;
+    for (int event: seen) {
+        if (event >= 1 && event <= reposts) {
+            reposted.push_back(event);
+        } else if (event > reposts) {
+            posted.push_back(event);
+        }
+    }
+    ASSERT_EQ(reposted.size(), std::size_t(reposts));
+    ASSERT_TRUE(std::is_sorted(reposted.begin(), reposted.end()));
+    ASSERT_EQ(posted.size(), 100u);
+    ASSERT_TRUE(std::is_sorted(posted.begin(), posted.end()));
+}
+
+TEST(TestBuffered, void_handler_is_fire_and_forget) {
+    int ctx = 0;
+    auto handler = Buffered {
+        [](int& ctx, int event){},
+    };
+    static_assert(std::is_void_v<decltype(handler(ctx, 1))>, "");
+}
+
+TEST(TestBuffered, completion) {
+    int ctx = 0;
+    auto handler = Buffered {
+        [](int& ctx, std::string event){return event + "!";},
+    };
+
+    // the same completion can be reused once its result has been taken
+    Completion<std::string> completion;
+    for (int i = 0; i < 3; i++) {
+        handler.submit(ctx, std::string("hello"), completion);
+        ASSERT_EQ(completion.get(), "hello!");
+        ASSERT_FALSE(completion.ready());
+    }
+}
+
+TEST(TestBuffered, completion_exception) {
+    int ctx = 0;
+    auto handler = Buffered {
+        [](int& ctx, int event) -> int {throw std::runtime_error("oops");},
+    };
+
+    Completion<int> completion;
+    handler.submit(ctx, 1, completion);
+    ASSERT_THROW(completion.get(), std::runtime_error);
+}
+
+TEST(TestBuffered, completion_dropped) {
+    // Jobs still queued when the Buffered is destroyed are never run, their
+    // completions must still become ready.
+    std::atomic<bool> started{false};
+    std::atomic<bool> release{false};
+    Completion<void> first;
+    Completion<void> second;
+    std::thread releaser;
+    {
+        int ctx = 0;
+        auto handler = Buffered {
+            [&](int& ctx, int event){
+                started = true;
+                while (!release) {
+                    std::this_thread::yield();
+                }
+            },
+        };
+        handler.submit(ctx, 1, first);
+        handler.submit(ctx, 2, second);
+        while (!started) {
+            std::this_thread::yield();
+        }
+        // the worker is stopped while it is still running the first job
+        releaser = std::thread([&]{
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            release = true;
+        });
+    }
+    releaser.join();
+    first.get();
+    ASSERT_THROW(second.get(), std::future_error);
+}
+
+namespace {
+    // Holds up a Buffered's worker inside its first event until opened.
+    struct Gate {
+        std::atomic<bool> entered{false};
+        std::atomic<bool> open{false};
+
+        void pass() {
+            entered = true;
+            while (!open) {
+                std::this_thread::yield();
+            }
+        }
+
+        void wait_entered() {
+            while (!entered) {
+                std::this_thread::yield();
+            }
+        }
+    };
+}
+
+TEST(TestBuffered, drop_newest) {
+    Gate gate;
+    std::vector<int> seen;
+    auto handler = Buffered {
+        [&](int& ctx, int event){
+            if (event == 0) {
+                gate.pass();
+            }
+            seen.push_back(event);
+            return event;
+        },
+        QueueLimits{2, 0, Overflow::DropNewest},
+    };
+
+    int ctx = 0;
+    auto first = handler(ctx, 0);
+    gate.wait_entered();
+    auto second = handler(ctx, 1);
+    auto dropped = handler(ctx, 2);
+    ASSERT_EQ(handler.stats().dropped_newest, 1u);
+    ASSERT_EQ(handler.stats().pending_jobs, 2u);
+
+    gate.open = true;
+    ASSERT_EQ(second.get(), 1);
+    ASSERT_THROW(dropped.get(), std::future_error);
+    ASSERT_EQ(seen, (std::vector<int>{0, 1}));
+}
+
+TEST(TestBuffered, reject) {
+    Gate gate;
+    auto handler = Buffered {
+        [&](int& ctx, int event){
+            gate.pass();
+            return event;
+        },
+        QueueLimits{1, 0, Overflow::Reject},
+    };
+
+    int ctx = 0;
+    auto first = handler(ctx, 0);
+    gate.wait_entered();
+
+    auto rejected = handler(ctx, 1);
+    ASSERT_EQ(rejected.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+    ASSERT_THROW(rejected.get(), QueueFull);
+
+    Completion<int> completion;
+    handler.submit(ctx, 2, completion);
+    ASSERT_THROW(completion.get(), QueueFull);
+    ASSERT_FALSE(handler.post(ctx, 3));
+    ASSERT_EQ(handler.stats().rejected, 3u);
+
+    gate.open = true;
+    ASSERT_EQ(first.get(), 0);
+}
+
+TEST(TestBuffered, drop_oldest) {
+    Gate gate;
+    std::vector<int> seen;
+    auto handler = Buffered {
+        [&](int& ctx, int event){
+            if (event == 0) {
+                gate.pass();
+            }
+            seen.push_back(event);
+        },
+        QueueLimits{3, 0, Overflow::DropOldest},
+    };
+
+    int ctx = 0;
+    handler.post(ctx, 0);
+    gate.wait_entered();
+    for (int i = 1; i <= 5; i++) {
+        ASSERT_TRUE(handler.post(ctx, i));
+    }
+    Completion<void> done;
+    handler.submit(ctx, 6, done);
+    gate.open = true;
+    done.get();
+    // 0 was running, once it finished the worker is over budget until it
+    // sheds enough of the oldest events.
+    ASSERT_EQ(seen, (std::vector<int>{0, 4, 5, 6}));
+    ASSERT_EQ(handler.stats().dropped_oldest, 3u);
+}
+
+TEST(TestBuffered, block) {
+    Gate gate;
+    std::atomic<int> total{0};
+    auto handler = Buffered {
+        [&](int& ctx, int event){
+            if (event == 0) {
+                gate.pass();
+            }
+            total += event;
+        },
+        QueueLimits{2, 0, Overflow::Block},
+    };
+
+    int ctx = 0;
+    handler.post(ctx, 0);
+    gate.wait_entered();
+
+    std::atomic<bool> producer_done{false};
+    std::thread producer([&]{
+        for (int i = 0; i < 10; i++) {
+            handler.post(ctx, 1);
+        }
+        producer_done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_FALSE(producer_done);
+    ASSERT_LE(handler.stats().pending_jobs, 2u);
+
+    gate.open = true;
+    producer.join();
+    Completion<void> done;
+    handler.submit(ctx, 0, done);
+    done.get();
+    ASSERT_EQ(total.load(), 10);
+    ASSERT_GE(handler.stats().blocked, 1u);
+    ASSERT_EQ(handler.stats().shed(), 0u);
+}
+
+TEST(TestBuffered, destroyed_with_jobs_queued) {
+    // Queued jobs hand their budget back as they are destroyed, which has to happen
+    // while the rest of the worker is still alive.
+    Gate gate;
+    std::vector<Completion<void>> queued(3);
+    std::thread opener;
+    {
+        int ctx = 0;
+        auto handler = Buffered {
+            [&](int& ctx, int event){
+                if (event == 0) {
+                    gate.pass();
+                }
+            },
+            QueueLimits{4, 0, Overflow::Block},
+        };
+        handler.post(ctx, 0);
+        gate.wait_entered();
+        for (std::size_t i = 0; i < queued.size(); i++) {
+            handler.submit(ctx, int(i) + 1, queued[i]);
+        }
+        ASSERT_EQ(handler.stats().pending_jobs, queued.size() + 1);
+        opener = std::thread([&]{
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            gate.open = true;
+        });
+    }
+    opener.join();
+    for (auto& completion: queued) {
+        ASSERT_THROW(completion.get(), std::future_error);
+    }
+}
+
+TEST(TestBuffered, byte_budget) {
+    Gate gate;
+    auto handler = Buffered {
+        [&](int& ctx, std::string event){
+            gate.pass();
+        },
+        QueueLimits{0, 4096, Overflow::DropNewest},
+    };
+
+    int ctx = 0;
+    handler.post(ctx, std::string());
+    gate.wait_entered();
+    // too big to fit next to the job that is running
+    ASSERT_FALSE(handler.post(ctx, std::string(8192, 'a')));
+    ASSERT_TRUE(handler.post(ctx, std::string(16, 'a')));
+    ASSERT_EQ(handler.stats().dropped_newest, 1u);
+    ASSERT_GT(handler.stats().pending_bytes, 16u);
+    gate.open = true;
+}
+
+TEST(TestBuffered, budget_bigger_than_the_ring) {
+    Gate gate;
+    std::vector<int> seen;
+    auto handler = Buffered {
+        [&](int& ctx, int event){
+            if (event == 0) {
+                gate.pass();
+            }
+            seen.push_back(event);
+        },
+        QueueLimits{100000, 0, Overflow::DropNewest},
+    };
+
+    int ctx = 0;
+    handler.post(ctx, 0);
+    gate.wait_entered();
+    // Well past what the preallocated ring holds, the rest spill over.
+    constexpr int events = 20000;
+    for (int i = 1; i <= events; i++) {
+        ASSERT_TRUE(handler.post(ctx, i));
+    }
+    ASSERT_EQ(handler.stats().pending_jobs, std::size_t(events) + 1);
+    gate.open = true;
+
+    Completion<void> done;
+    handler.submit(ctx, events + 1, done);
+    done.get();
+    ASSERT_EQ(seen.size(), std::size_t(events) + 2);
+    ASSERT_TRUE(std::is_sorted(seen.begin(), seen.end()));
+    ASSERT_EQ(handler.stats().shed(), 0u);
+}
+
+TEST(TestBuffered, drop_oldest_sheds_spilled_jobs) {
+    Gate gate;
+    std::vector<int> seen;
+    auto handler = Buffered {
+        [&](int& ctx, int event){
+            if (event == 0) {
+                gate.pass();
+            }
+            seen.push_back(event);
+        },
+        QueueLimits{6000, 0, Overflow::DropOldest},
+    };
+
+    int ctx = 0;
+    handler.post(ctx, 0);
+    gate.wait_entered();
+    constexpr int events = 10000;
+    for (int i = 1; i <= events; i++) {
+        handler.post(ctx, i);
+    }
+    gate.open = true;
+
+    Completion<void> done;
+    handler.submit(ctx, events + 1, done);
+    done.get();
+    // The newest events are kept, in order.
+    ASSERT_TRUE(std::is_sorted(seen.begin(), seen.end()));
+    ASSERT_EQ(seen.size() + handler.stats().dropped_oldest, std::size_t(events) + 2);
+    ASSERT_GE(handler.stats().dropped_oldest, std::size_t(events) - 6000);
+    ASSERT_EQ(seen[seen.size() - 2], events);
+}
+
+TEST(TestBuffered, batch_handler) {
+    Gate gate;
+    std::vector<std::vector<int>> batches;
+    std::vector<std::string> strings;
+    auto handler = Buffered {
+        Serial {
+            [&](int& ctx, Span<const int> events){
+                if (events[0] == 0) {
+                    gate.pass();
+                }
+                batches.emplace_back(events.begin(), events.end());
+            },
+            [&](int& ctx, std::string event){strings.push_back(event);},
+        },
+    };
+    static_assert(std::is_void_v<decltype(handler(std::declval<int&>(), 1))>, "");
+
+    int ctx = 0;
+    handler.post(ctx, 0);
+    gate.wait_entered();
+    for (int i = 1; i <= 3; i++) {
+        handler.post(ctx, i);
+    }
+    handler.post(ctx, std::string("a"));
+    Completion<void> first;
+    Completion<void> second;
+    handler.submit(ctx, 4, first);
+    handler.submit(ctx, 5, second);
+    gate.open = true;
+    first.get();
+    second.get();
+
+    // the string splits the ints into two batches
+    ASSERT_EQ(batches, (std::vector<std::vector<int>>{{0}, {1, 2, 3}, {4, 5}}));
+    ASSERT_EQ(strings, (std::vector<std::string>{"a"}));
+}
+
+TEST(TestBuffered, nested_batches) {
+    Executor executor(1);
+    Gate gate;
+    auto blocker = Buffered {
+        [&](int& ctx, int event){gate.pass();},
+        executor,
+    };
+
+    int outer_ctx = 0;
+    int inner_ctx = 1;
+    std::vector<int> outer;
+    std::vector<int> inner;
+    std::atomic<int> batches{0};
+    // Both Buffereds have the same job type, the outer batch runs the inner one on its
+    // own thread while its span is still in use.
+    std::function<void(int&, Span<const int>)> handle = [&](int& ctx, Span<const int> events){
+        if (&ctx == &outer_ctx) {
+            executor.try_run_one();
+            outer.assign(events.begin(), events.end());
+        } else {
+            inner.assign(events.begin(), events.end());
+        }
+        batches++;
+    };
+    auto first = Buffered{handle, executor};
+    auto second = Buffered{handle, executor};
+
+    int ctx = 0;
+    blocker.post(ctx, 0);
+    gate.wait_entered();
+    for (int i = 0; i < 4; i++) {
+        first.post(outer_ctx, i);
+    }
+    for (int i = 10; i < 14; i++) {
+        second.post(inner_ctx, i);
+    }
+    gate.open = true;
+    while (batches < 2) {
+        std::this_thread::yield();
+    }
+
+    ASSERT_EQ(outer, (std::vector<int>{0, 1, 2, 3}));
+    ASSERT_EQ(inner, (std::vector<int>{10, 11, 12, 13}));
+}
+
+TEST(TestBuffered, batch_handler_exception) {
+    Gate gate;
+    auto handler = Buffered {
+        [&](int& ctx, Span<const int> events){
+            if (events[0] == 0) {
+                gate.pass();
+                return;
+            }
+            throw std::runtime_error("batch failed");
+        },
+    };
+
+    int ctx = 0;
+    handler.post(ctx, 0);
+    gate.wait_entered();
+    Completion<void> first;
+    Completion<void> second;
+    handler.submit(ctx, 1, first);
+    handler.submit(ctx, 2, second);
+    gate.open = true;
+    ASSERT_THROW(first.get(), std::runtime_error);
+    ASSERT_THROW(second.get(), std::runtime_error);
+}
+
+TEST(TestBuffered, generic_handler_is_not_batched) {
+    std::vector<int> seen;
+    auto handler = Buffered {
+        [&](int& ctx, auto event) -> decltype(seen.push_back(event)) {seen.push_back(event);},
+    };
+    static_assert(!detail::is_batch_handler_v<decltype(handler), int, int>, "");
+
+    int ctx = 0;
+    handler.post(ctx, 1);
+    Completion<void> done;
+    handler.submit(ctx, 2, done);
+    done.get();
+    ASSERT_EQ(seen, (std::vector<int>{1, 2}));
+}
+
+namespace {
+    struct Resize {
+        int id;
+    };
+
+    void wait_for(std::atomic<int>& handled, int count) {
+        while (handled < count) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+template<>
+struct event_priority<Resize> {
+    static constexpr unsigned value = 1;
+};
+
+TEST(TestBuffered, strict_priority_lanes) {
+    Gate gate;
+    std::vector<int> seen;
+    std::atomic<int> handled{0};
+    auto handler = Buffered {
+        Serial {
+            [&](int& ctx, int event){
+                if (event < 0) {
+                    gate.pass();
+                }
+                seen.push_back(event);
+                handled++;
+            },
+            [&](int& ctx, Resize event){
+                seen.push_back(100 + event.id);
+                handled++;
+            },
+        },
+        QueueLimits{},
+        PriorityLanes{2, LaneScheduling::Strict},
+    };
+
+    int ctx = 0;
+    handler.post(ctx, -1);
+    gate.wait_entered();
+    for (int i = 0; i < 5; i++) {
+        handler.post(ctx, i);
+        handler.post(ctx, Resize{i});
+    }
+    handler.post(ctx, 5, Priority{1});
+    gate.open = true;
+    wait_for(handled, 12);
+
+    ASSERT_EQ(seen, (std::vector<int>{-1, 100, 101, 102, 103, 104, 5, 0, 1, 2, 3, 4}));
+    ASSERT_EQ(handler.lane_count(), 2u);
+    ASSERT_EQ(handler.queue_delay(1).count(), 6u);
+    ASSERT_EQ(handler.queue_delay(0).count(), 6u);
+    // The urgent events only waited for the gate, the others for them too.
+    ASSERT_LE(handler.queue_delay(1).max(), handler.queue_delay(0).max());
+}
+
+TEST(TestBuffered, starvation_protection) {
+    Gate gate;
+    std::vector<int> seen;
+    std::atomic<int> handled{0};
+    PriorityLanes lanes{2, LaneScheduling::Strict};
+    lanes.batch = 1;
+    lanes.starvation_limit = 2;
+    auto handler = Buffered {
+        [&](int& ctx, int event){
+            if (event < 0) {
+                gate.pass();
+            }
+            seen.push_back(event);
+            handled++;
+        },
+        QueueLimits{},
+        lanes,
+    };
+
+    int ctx = 0;
+    handler.post(ctx, -1);
+    gate.wait_entered();
+    for (int i = 0; i < 3; i++) {
+        handler.post(ctx, i);
+    }
+    for (int i = 0; i < 6; i++) {
+        handler.post(ctx, 100 + i, Priority{1});
+    }
+    gate.open = true;
+    wait_for(handled, 10);
+
+    // Every second pick goes to the lane that was passed over twice.
+    ASSERT_EQ(seen, (std::vector<int>{-1, 100, 0, 101, 1, 102, 2, 103, 104, 105}));
+}
+
+TEST(TestBuffered, weighted_fair_lanes) {
+    Gate gate;
+    std::vector<int> seen;
+    std::atomic<int> handled{0};
+    auto handler = Buffered {
+        [&](int& ctx, int event){
+            if (event < 0) {
+                gate.pass();
+            }
+            seen.push_back(event);
+            handled++;
+        },
+        QueueLimits{},
+        PriorityLanes{2, LaneScheduling::WeightedFair, {1, 3}},
+    };
+
+    int ctx = 0;
+    handler.post(ctx, -1);
+    gate.wait_entered();
+    for (int i = 0; i < 3; i++) {
+        handler.post(ctx, i);
+    }
+    for (int i = 0; i < 6; i++) {
+        handler.post(ctx, 100 + i, Priority{1});
+    }
+    gate.open = true;
+    wait_for(handled, 10);
+
+    ASSERT_EQ(seen, (std::vector<int>{-1, 100, 101, 102, 0, 103, 104, 105, 1, 2}));
+}
+
+TEST(TestBuffered, wait_strategies) {
+    for (auto wait: {WaitStrategy::Park, WaitStrategy::SpinPark, WaitStrategy::SpinYield, WaitStrategy::BusySpin}) {
+        WorkerOptions options;
+        options.wait = wait;
+        options.spins = 64;
+        std::atomic<int> handled{0};
+        auto buffered = Buffered {
+            [&](int& ctx, int event){handled += event;},
+            QueueLimits{},
+            options,
+        };
+        int ctx = 0;
+        for (int burst = 0; burst < 4; burst++) {
+            for (int i = 0; i < 100; i++) {
+                buffered.post(ctx, 1);
+            }
+            Completion<void> done;
+            buffered.submit(ctx, 0, done);
+            done.get();
+            // Long enough for the spinning strategies to run out of spins.
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_EQ(handled, 400);
+    }
+}
+
+#ifdef __linux__
+TEST(TestBuffered, worker_thread_options) {
+    WorkerOptions options;
+    options.cpu = 0;
+    options.name = "buffered-worker-with-a-long-name";
+    auto buffered = Buffered {
+        [](int& ctx, int event){
+            char name[16] = {};
+            pthread_getname_np(pthread_self(), name, sizeof(name));
+            return std::make_pair(std::string(name), sched_getcpu());
+        },
+        QueueLimits{},
+        options,
+    };
+    int ctx = 0;
+    Completion<std::pair<std::string, int>> done;
+    buffered.submit(ctx, 0, done);
+    auto [name, cpu] = done.get();
+    ASSERT_EQ(name, "buffered-worker");
+    ASSERT_EQ(cpu, 0);
+
+    options.cpu = CPU_SETSIZE;
+    auto pin_to_missing_cpu = [&]{
+        Buffered{[](int& ctx, int event){}, QueueLimits{}, options};
+    };
+    ASSERT_THROW(pin_to_missing_cpu(), std::system_error);
+}
+#endif
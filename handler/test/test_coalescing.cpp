@@ -0,0 +1,153 @@
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/coalescing.h"
+#include "event/serial.h"
+
+namespace {
+    struct Pose {
+        int id;
+        int value;
+    };
+
+    struct Gate {
+        std::atomic<bool> entered{false};
+        std::atomic<bool> open{false};
+
+        void pass() {
+            entered = true;
+            while (!open) {
+                std::this_thread::yield();
+            }
+        }
+
+        void wait_entered() {
+            while (!entered) {
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    template<typename F>
+    void wait_until(F done) {
+        while (!done()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+TEST(TestCoalescing, latest_value_wins) {
+    Gate gate;
+    std::mutex mutex;
+    std::vector<int> ints;
+    std::vector<std::string> strings;
+    auto handler = Coalescing {
+        Serial {
+            [&](int& ctx, int event){
+                if (event == 0) {
+                    gate.pass();
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                ints.push_back(event);
+            },
+            [&](int& ctx, std::string event){
+                std::lock_guard<std::mutex> lock(mutex);
+                strings.push_back(event);
+            },
+        },
+    };
+
+    int ctx = 0;
+    handler(ctx, 0);
+    gate.wait_entered();
+    for (int i = 1; i <= 10; i++) {
+        handler(ctx, i);
+    }
+    handler(ctx, std::string("a"));
+    handler(ctx, std::string("b"));
+    gate.open = true;
+
+    wait_until([&]{
+        std::lock_guard<std::mutex> lock(mutex);
+        return ints.size() == 2 && strings.size() == 1;
+    });
+    ASSERT_EQ(ints, (std::vector<int>{0, 10}));
+    ASSERT_EQ(strings, (std::vector<std::string>{"b"}));
+    ASSERT_EQ(handler.coalesced(), 10u);
+}
+
+TEST(TestCoalescing, by_key) {
+    Gate gate;
+    std::mutex mutex;
+    std::map<int, std::vector<int>> seen;
+    auto handler = Coalescing {
+        [&](int& ctx, Pose event){
+            if (event.value == 0) {
+                gate.pass();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            seen[event.id].push_back(event.value);
+        },
+        [](const Pose& pose){return pose.id;},
+    };
+
+    int ctx = 0;
+    handler(ctx, Pose{0, 0});
+    gate.wait_entered();
+    for (int i = 1; i <= 5; i++) {
+        handler(ctx, Pose{1, i});
+        handler(ctx, Pose{2, 10 + i});
+    }
+    gate.open = true;
+
+    wait_until([&]{
+        std::lock_guard<std::mutex> lock(mutex);
+        return seen[1].size() == 1 && seen[2].size() == 1;
+    });
+    ASSERT_EQ(seen[0], (std::vector<int>{0}));
+    ASSERT_EQ(seen[1], (std::vector<int>{5}));
+    ASSERT_EQ(seen[2], (std::vector<int>{15}));
+    ASSERT_EQ(handler.coalesced(), 8u);
+}
+
+TEST(TestCoalescing, keys_are_dropped_once_handled) {
+    std::atomic<int> handled{0};
+    auto handler = Coalescing {
+        [&](int& ctx, Pose event){handled++;},
+        [](const Pose& pose){return pose.id;},
+    };
+
+    int ctx = 0;
+    // Every key is new, like entities coming and going.
+    constexpr int keys = 10000;
+    for (int i = 0; i < keys; i++) {
+        handler(ctx, Pose{i, i});
+    }
+    wait_until([&]{return handled == keys;});
+    ASSERT_EQ(handler.slot_count(), 0u);
+
+    // A key that comes back gets a slot of its own again.
+    handler(ctx, Pose{0, 1});
+    wait_until([&]{return handled == keys + 1;});
+    ASSERT_EQ(handler.slot_count(), 0u);
+}
+
+TEST(TestCoalescing, executor) {
+    Executor executor(2);
+    std::atomic<int> last{-1};
+    auto handler = Coalescing {
+        [&](int& ctx, int event){last = event;},
+        executor,
+    };
+
+    int ctx = 0;
+    for (int i = 0; i < 1000; i++) {
+        handler(ctx, i);
+    }
+    wait_until([&]{return last == 999;});
+}
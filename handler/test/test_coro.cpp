@@ -0,0 +1,128 @@
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/coro.h"
+#include "event/first.h"
+#include "event/must_handle.h"
+
+namespace {
+    struct Lookup {
+        std::string key;
+    };
+
+    struct Count {};
+
+    // Cut down version of the app's Ctx.
+    template<typename RequestHandlerT>
+    struct Ctx {
+        RequestHandlerT request_handler;
+
+        template<typename RequestT>
+        auto handle_request(RequestT&& request) {
+            return request_handler(*this, std::forward<RequestT>(request));
+        }
+    };
+
+    template<typename RequestHandlerT>
+    Ctx(RequestHandlerT) -> Ctx<RequestHandlerT>;
+}
+
+TEST(TestCoro, handle_request_async) {
+    Executor executor(2);
+    auto lengths = Buffered {
+        [](int& ctx, std::string event){return event.size();},
+        executor,
+    };
+    int lengths_ctx = 0;
+
+    auto ctx = Ctx {
+        First {
+            [&](auto& ctx, Lookup request) -> Async<std::size_t> {
+                co_return co_await submit_async(lengths, lengths_ctx, request.key);
+            },
+            [](auto& ctx, Count request) {return 42;},
+        },
+    };
+
+    ASSERT_EQ(sync_wait(handle_request_async(ctx, Lookup{"hello"})), 5u);
+    ASSERT_EQ(sync_wait(handle_request_async(ctx, Count{})), 42);
+}
+
+TEST(TestCoro, exceptions) {
+    auto failing = Buffered {
+        [](int& ctx, int event) -> int {throw std::runtime_error("failed");},
+    };
+    int ctx = 0;
+    auto coroutine = [&]() -> Async<int> {
+        co_return co_await submit_async(failing, ctx, 1);
+    };
+    ASSERT_THROW(sync_wait(coroutine()), std::runtime_error);
+}
+
+TEST(TestCoro, batching) {
+    auto lengths = Batching{8, std::chrono::milliseconds(1), [](int& ctx, Span<const std::string> keys){
+        std::vector<std::size_t> results;
+        for (auto& key: keys) {
+            results.push_back(key.size());
+        }
+        return results;
+    }};
+    int ctx = 0;
+    auto coroutine = [&]() -> Async<std::size_t> {
+        std::size_t a = co_await submit_async(lengths, ctx, std::string("four"));
+        std::size_t b = co_await submit_async(lengths, ctx, std::string("seven!!"));
+        co_return a + b;
+    };
+    ASSERT_EQ(sync_wait(coroutine()), 11u);
+}
+
+TEST(TestCoro, schedulers) {
+    Executor executor(1);
+    LoopScheduler loop;
+    std::thread::id main_thread = std::this_thread::get_id();
+    std::atomic<bool> on_pool{false};
+    std::atomic<bool> back_on_loop{false};
+
+    auto coroutine = [&]() -> Async<void> {
+        co_await schedule_on(executor);
+        on_pool = std::this_thread::get_id() != main_thread;
+        co_await schedule_on(loop);
+        back_on_loop = std::this_thread::get_id() == main_thread;
+    };
+    spawn(coroutine());
+
+    while (!back_on_loop) {
+        loop.run_pending();
+        std::this_thread::yield();
+    }
+    ASSERT_TRUE(on_pool);
+}
+
+TEST(TestCoro, many_in_flight) {
+    constexpr int in_flight = 2000;
+    Executor executor(2);
+    auto doubler = Buffered {
+        [](int& ctx, int event){return event * 2;},
+        executor,
+    };
+    int ctx = 0;
+    std::atomic<int> total{0};
+    std::atomic<int> done{0};
+
+    auto request = [&](int i) -> Async<void> {
+        total += co_await submit_async(doubler, ctx, i);
+        done++;
+    };
+    for (int i = 0; i < in_flight; i++) {
+        spawn(request(1));
+    }
+    while (done < in_flight) {
+        std::this_thread::yield();
+    }
+    ASSERT_EQ(total, 2 * in_flight);
+}
@@ -0,0 +1,138 @@
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/dynamic.h"
+#include "event/serial.h"
+
+namespace {
+    struct Resize {
+        int width;
+        int height;
+    };
+
+    struct Key {
+        char c;
+    };
+
+    // Handlers of different types than the lambdas below.
+    struct KeyLogger {
+        std::string* log;
+        void operator()(int& ctx, const Key& event) {log->push_back(event.c);}
+    };
+}
+
+TEST(TestDynamicAny, dispatches_by_event_type) {
+    DynamicAny<int> handler;
+    std::string log;
+    int resizes = 0;
+    handler.add<Key>(KeyLogger{&log});
+    handler.add<Key>([&](int& ctx, const Key& event){log.push_back('!');});
+    handler.add<Resize>([&](int& ctx, const Resize& event){resizes++; ctx = event.width;});
+
+    int ctx = 0;
+    handler(ctx, Key{'a'});
+    handler(ctx, Resize{640, 480});
+    handler(ctx, std::string("nobody handles this"));
+    ASSERT_EQ(log, "a!");
+    ASSERT_EQ(resizes, 1);
+    ASSERT_EQ(ctx, 640);
+    ASSERT_EQ(handler.handler_count<Key>(), 2u);
+    ASSERT_EQ(handler.handler_count<std::string>(), 0u);
+}
+
+TEST(TestDynamicAny, remove) {
+    DynamicAny<int> handler;
+    std::vector<int> seen;
+    auto first = handler.add<int>([&](int& ctx, int event){seen.push_back(1);});
+    handler.add<int>([&](int& ctx, int event){seen.push_back(2);});
+
+    int ctx = 0;
+    handler(ctx, 0);
+    ASSERT_TRUE(handler.remove(first));
+    ASSERT_FALSE(handler.remove(first));
+    handler(ctx, 0);
+    ASSERT_EQ(seen, (std::vector<int>{1, 2, 2}));
+}
+
+TEST(TestDynamicAny, several_event_types) {
+    DynamicAny<int> handler;
+    int calls = 0;
+    struct Counter {
+        int* calls;
+        void operator()(int& ctx, const Key&) {(*calls)++;}
+        void operator()(int& ctx, const Resize&) {(*calls) += 10;}
+    };
+    auto id = handler.add<Key, Resize>(Counter{&calls});
+
+    int ctx = 0;
+    handler(ctx, Key{'a'});
+    handler(ctx, Resize{1, 1});
+    ASSERT_EQ(calls, 11);
+
+    ASSERT_TRUE(handler.remove(id));
+    handler(ctx, Key{'a'});
+    handler(ctx, Resize{1, 1});
+    ASSERT_EQ(calls, 11);
+}
+
+TEST(TestDynamicAny, inside_serial) {
+    std::string log;
+    DynamicAny<int> plugins;
+    plugins.add<Key>(KeyLogger{&log});
+    auto handler = Serial {
+        [&](int& ctx, const Key& event){log.push_back('<');},
+        std::ref(plugins),
+    };
+
+    int ctx = 0;
+    handler(ctx, Key{'x'});
+    ASSERT_EQ(log, "<x");
+}
+
+TEST(TestDynamicAny, remove_during_dispatch) {
+    DynamicAny<int> handler;
+    int calls = 0;
+    DynamicAny<int>::Id id = 0;
+    id = handler.add<int>([&](int& ctx, int event){
+        calls++;
+        handler.remove(id);
+    });
+
+    int ctx = 0;
+    handler(ctx, 0);
+    handler(ctx, 0);
+    ASSERT_EQ(calls, 1);
+}
+
+TEST(TestDynamicAny, concurrent_registration) {
+    DynamicAny<int> handler;
+    std::atomic<bool> stop{false};
+    std::atomic<int> calls{0};
+    handler.add<int>([&](int& ctx, int event){calls++;});
+
+    std::vector<std::thread> dispatchers;
+    for (int t = 0; t < 4; t++) {
+        dispatchers.emplace_back([&]{
+            int ctx = 0;
+            while (!stop) {
+                handler(ctx, 1);
+            }
+        });
+    }
+    while (calls == 0) {
+        std::this_thread::yield();
+    }
+    for (int i = 0; i < 500; i++) {
+        auto id = handler.add<int>([s = std::string(32, 'x')](int& ctx, int event){ASSERT_EQ(s.size(), 32u);});
+        std::this_thread::yield();
+        handler.remove(id);
+    }
+    stop = true;
+    for (auto& thread: dispatchers) {
+        thread.join();
+    }
+    ASSERT_EQ(handler.handler_count<int>(), 1u);
+}
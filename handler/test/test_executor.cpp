@@ -0,0 +1,151 @@
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/executor.h"
+#include "event/buffered.h"
+
+
+namespace {
+    struct CountingTask: detail::Task {
+        CountingTask(std::atomic<int>& count): detail::Task{&CountingTask::run_task}, count(count) {}
+        std::atomic<int>& count;
+
+        static void run_task(detail::Task& task) {
+            static_cast<CountingTask&>(task).count++;
+        }
+    };
+}
+
+TEST(TestExecutor, runs_tasks) {
+    std::atomic<int> count{0};
+    std::vector<CountingTask> tasks(100, CountingTask{count});
+    {
+        Executor executor(3);
+        ASSERT_EQ(executor.size(), 3u);
+        for (auto& task: tasks) {
+            executor.schedule(task);
+        }
+        while (count < 100) {
+            std::this_thread::yield();
+        }
+    }
+    ASSERT_EQ(count.load(), 100);
+}
+
+TEST(TestExecutor, strands_keep_order) {
+    Executor executor(4);
+    constexpr int handlers = 200;
+    constexpr int events = 50;
+
+    struct State {
+        std::vector<int> seen;
+        std::atomic<bool> running{false};
+        bool overlapped = false;
+    };
+    std::vector<State> states(handlers);
+
+    auto make = [&](State& state) {
+        return Buffered {
+            [&state](int& ctx, int event){
+                // a strand never runs two of its events at once
+                if (state.running.exchange(true)) {
+                    state.overlapped = true;
+                }
+                state.seen.push_back(event);
+                state.running = false;
+            },
+            executor,
+        };
+    };
+    using HandlerT = decltype(make(states[0]));
+    std::vector<std::unique_ptr<HandlerT>> buffered;
+    for (auto& state: states) {
+        buffered.push_back(std::make_unique<HandlerT>(make(state)));
+    }
+
+    int ctx = 0;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < 2; p++) {
+        producers.emplace_back([&, p]{
+            for (int i = 0; i < events; i++) {
+                for (int h = p; h < handlers; h += 2) {
+                    buffered[h]->post(ctx, i);
+                }
+            }
+        });
+    }
+    for (auto& producer: producers) {
+        producer.join();
+    }
+
+    for (auto& handler: buffered) {
+        Completion<void> done;
+        handler->submit(ctx, events, done);
+        done.get();
+    }
+
+    std::vector<int> expected;
+    for (int i = 0; i <= events; i++) {
+        expected.push_back(i);
+    }
+    for (auto& state: states) {
+        ASSERT_FALSE(state.overlapped);
+        ASSERT_EQ(state.seen, expected);
+    }
+}
+
+TEST(TestExecutor, destroy_strand_with_queued_events) {
+    Executor executor(1);
+    std::atomic<int> ran{0};
+    for (int i = 0; i < 20; i++) {
+        auto handler = Buffered {
+            [&ran](int& ctx, int event){ran++;},
+            executor,
+        };
+        int ctx = 0;
+        for (int j = 0; j < 100; j++) {
+            handler.post(ctx, j);
+        }
+    }
+    ASSERT_LE(ran.load(), 2000);
+}
+
+TEST(TestExecutor, destroy_strand_from_a_task) {
+    // One thread, so the strand being destroyed is queued behind the task doing it.
+    Executor executor(1);
+    std::atomic<int> ran{0};
+    auto target = std::make_unique<Buffered<std::function<void(int&, int)>>>(
+        [&ran](int& ctx, int event){ran++;},
+        executor
+    );
+    auto destroyer = Buffered {
+        [&target](int& ctx, int event){
+            target->post(ctx, event);
+            target.reset();
+        },
+        executor,
+    };
+
+    int ctx = 0;
+    Completion<void> done;
+    destroyer.submit(ctx, 1, done);
+    done.get();
+    ASSERT_EQ(target, nullptr);
+    ASSERT_LE(ran.load(), 1);
+}
+
+TEST(TestExecutor, shared) {
+    ASSERT_EQ(&Executor::shared(), &Executor::shared());
+    ASSERT_EQ(Executor::shared().size(), Executor::default_thread_count());
+
+    int ctx = 0;
+    auto handler = Buffered {
+        [](int& ctx, int event){return event * 2;},
+        Executor::shared(),
+    };
+    ASSERT_EQ(handler(ctx, 21).get(), 42);
+}
@@ -0,0 +1,97 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/frame_arena.h"
+#include "event/buffered.h"
+
+namespace {
+    struct Point {
+        int x;
+        int y;
+    };
+
+    struct alignas(64) Wide {
+        char bytes[64];
+    };
+}
+
+TEST(TestFrameArena, allocates_and_reuses) {
+    FrameArena arena(1024);
+    auto point = arena.make<Point>(Point{1, 2});
+    auto name = arena.copy("a string long enough to live on the heap as a std::string");
+    std::vector<int> values{1, 2, 3};
+    auto span = arena.copy(Span<const int>(values.data(), values.size()));
+    auto wide = arena.make<Wide>();
+
+    ASSERT_EQ(point->y, 2);
+    ASSERT_EQ(name.view(), "a string long enough to live on the heap as a std::string");
+    ASSERT_EQ(span.get()[2], 3);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(&*wide) % 64, 0u);
+
+    // Bigger than a chunk.
+    std::string big(4096, 'x');
+    ASSERT_EQ(arena.copy(big).view(), big);
+    std::size_t capacity = arena.capacity();
+
+    arena.end_frame();
+    ASSERT_EQ(arena.bytes_used(), 0u);
+    ASSERT_THROW(point.get(), StaleFrameRef);
+    ASSERT_THROW(name.copy_out(), StaleFrameRef);
+    ASSERT_THROW(span.get(), StaleFrameRef);
+
+    // The next frame fits in the memory the last one grew to.
+    ASSERT_EQ(arena.copy(big).view(), big);
+    arena.make<Point>(Point{3, 4});
+    ASSERT_EQ(arena.capacity(), capacity);
+}
+
+TEST(TestFrameArena, buffered_copies_out) {
+    FrameArena arena;
+    std::vector<std::string> seen;
+    auto handler = Buffered {
+        [&](int& ctx, FrameString s){seen.push_back(s.copy_out());},
+    };
+
+    int ctx = 0;
+    handler.post(ctx, arena.copy("first"));
+    Completion<void> done;
+    handler.submit(ctx, arena.copy("second"), done);
+    done.get();
+
+    // Ended before the worker got to it.
+    auto late = arena.copy("late");
+    arena.end_frame();
+    Completion<void> failed;
+    handler.submit(ctx, late, failed);
+    ASSERT_THROW(failed.get(), StaleFrameRef);
+    ASSERT_EQ(seen, (std::vector<std::string>{"first", "second"}));
+}
+
+TEST(TestFrameArena, end_frame_waits_for_copies) {
+    FrameArena arena;
+    std::string payload(1 << 16, 'x');
+    std::atomic<bool> stop{false};
+    std::atomic<int> copies{0};
+    auto s = arena.copy(payload);
+    std::thread reader([&]{
+        // Every copy either sees the whole payload or throws, never a half reused one.
+        while (!stop) {
+            try {
+                ASSERT_EQ(s.copy_out(), payload);
+                copies++;
+            } catch (const StaleFrameRef&) {
+                return;
+            }
+        }
+    });
+    while (copies == 0) {
+        std::this_thread::yield();
+    }
+    arena.end_frame();
+    arena.copy(std::string(1 << 16, 'y'));
+    stop = true;
+    reader.join();
+}
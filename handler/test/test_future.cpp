@@ -0,0 +1,134 @@
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/buffered.h"
+#include "event/future.h"
+
+TEST(TestFuture, then_chains_buffered_handlers) {
+    auto length = Buffered {
+        [](int& ctx, std::string event){return event.size();},
+    };
+    auto twice = Buffered {
+        [](int& ctx, std::size_t event){return 2 * event;},
+    };
+
+    int ctx = 0;
+    auto future = length.async(ctx, std::string("hello"))
+        .then([&](std::size_t n){return twice.async(ctx, n);})
+        .then([](std::size_t n){return std::to_string(n);});
+    ASSERT_EQ(future.get(), "10");
+}
+
+TEST(TestFuture, then_on_scheduler) {
+    Executor executor(1);
+    LoopScheduler loop;
+    auto handler = Buffered {
+        [](int& ctx, int event){return event + 1;},
+    };
+
+    int ctx = 0;
+    std::thread::id main_thread = std::this_thread::get_id();
+    std::atomic<bool> on_pool{false};
+    auto future = handler.async(ctx, 1)
+        .then(executor, [&](int n){
+            on_pool = std::this_thread::get_id() != main_thread;
+            return n + 1;
+        })
+        .then(loop, [&](int n){
+            EXPECT_EQ(std::this_thread::get_id(), main_thread);
+            return n + 1;
+        });
+
+    while (!future.ready()) {
+        loop.run_pending();
+        std::this_thread::yield();
+    }
+    ASSERT_EQ(future.get(), 4);
+    ASSERT_TRUE(on_pool);
+}
+
+TEST(TestFuture, errors_skip_continuations) {
+    auto handler = Buffered {
+        [](int& ctx, int event) -> int {throw std::runtime_error("failed");},
+    };
+
+    int ctx = 0;
+    bool called = false;
+    auto future = handler.async(ctx, 1).then([&](int n){called = true;});
+    ASSERT_THROW(future.get(), std::runtime_error);
+    ASSERT_FALSE(called);
+}
+
+TEST(TestFuture, void_results) {
+    std::atomic<int> seen{0};
+    auto handler = Buffered {
+        [&](int& ctx, int event){seen = event;},
+    };
+
+    int ctx = 0;
+    auto future = handler.async(ctx, 5).then([&]{return seen.load();});
+    ASSERT_EQ(future.get(), 5);
+}
+
+TEST(TestFuture, when_all) {
+    auto handler = Buffered {
+        [](int& ctx, int event){return event * event;},
+    };
+
+    int ctx = 0;
+    std::vector<Future<int>> futures;
+    for (int i = 0; i < 4; i++) {
+        futures.push_back(handler.async(ctx, i));
+    }
+    auto all = when_all(std::move(futures)).then([](std::vector<int> squares){
+        int total = 0;
+        for (int square: squares) {
+            total += square;
+        }
+        return total;
+    });
+    ASSERT_EQ(all.get(), 14);
+
+    ASSERT_EQ(when_all(handler.async(ctx, 2), handler.async(ctx, 3)).get(), (std::vector<int>{4, 9}));
+    ASSERT_TRUE(when_all(std::vector<Future<int>>{}).get().empty());
+}
+
+TEST(TestFuture, when_all_error) {
+    auto handler = Buffered {
+        [](int& ctx, int event){
+            if (event == 1) {
+                throw std::runtime_error("failed");
+            }
+            return event;
+        },
+    };
+
+    int ctx = 0;
+    ASSERT_THROW(when_all(handler.async(ctx, 0), handler.async(ctx, 1), handler.async(ctx, 2)).get(), std::runtime_error);
+}
+
+TEST(TestFuture, when_any) {
+    std::atomic<bool> open{false};
+    auto slow = Buffered {
+        [&](int& ctx, int event){
+            while (!open) {
+                std::this_thread::yield();
+            }
+            return event;
+        },
+    };
+    auto fast = Buffered {
+        [](int& ctx, int event){return event;},
+    };
+
+    int ctx = 0;
+    auto any = when_any(slow.async(ctx, 1), fast.async(ctx, 2));
+    auto [index, value] = any.get();
+    ASSERT_EQ(index, 1u);
+    ASSERT_EQ(value, 2);
+    open = true;
+}
@@ -0,0 +1,149 @@
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/instrumented.h"
+#include "event/first.h"
+#include "event/serial.h"
+
+namespace {
+    struct Tick {};
+
+    const HandlerStats* find_stats(const std::vector<HandlerStats>& all, const std::string& name, const char* event_type) {
+        for (auto& stats: all) {
+            if (stats.name == name && stats.event_type == event_type) {
+                return &stats;
+            }
+        }
+        return nullptr;
+    }
+}
+
+TEST(TestInstrumented, histogram_buckets) {
+    for (std::uint64_t v: {0ull, 1ull, 31ull, 32ull, 33ull, 1000ull, 123456789ull}) {
+        std::size_t bucket = LatencyHistogram::bucket_of(v);
+        ASSERT_LE(LatencyHistogram::lower_bound(bucket), v);
+        ASSERT_LT(v, LatencyHistogram::lower_bound(bucket + 1));
+        ASSERT_LE(v - LatencyHistogram::lower_bound(bucket), v / LatencyHistogram::sub_buckets);
+    }
+    ASSERT_EQ(LatencyHistogram::bucket_of(~0ull), LatencyHistogram::buckets - 1);
+
+    // Everything below 2^40 still gets a bucket of its own, the last one ends at 2^40.
+    constexpr std::uint64_t top = 1ull << 40;
+    for (std::uint64_t v: {top / 2 - 1, top / 2, top / 2 + top / 32, top - 1}) {
+        std::size_t bucket = LatencyHistogram::bucket_of(v);
+        ASSERT_LE(LatencyHistogram::lower_bound(bucket), v);
+        ASSERT_LE(v - LatencyHistogram::lower_bound(bucket), v / LatencyHistogram::sub_buckets);
+    }
+    ASSERT_EQ(LatencyHistogram::lower_bound(LatencyHistogram::bucket_of(top / 2)), top / 2);
+    ASSERT_LT(LatencyHistogram::bucket_of(top / 2), LatencyHistogram::buckets - 1);
+    ASSERT_EQ(LatencyHistogram::bucket_of(top - 1), LatencyHistogram::buckets - 1);
+    ASSERT_EQ(LatencyHistogram::lower_bound(LatencyHistogram::buckets), top);
+    ASSERT_EQ(LatencyHistogram::bucket_of(top), LatencyHistogram::buckets - 1);
+
+    LatencyHistogram histogram;
+    for (std::uint64_t v = 1; v <= 100; v++) {
+        histogram.record(v * 1000);
+    }
+    ASSERT_EQ(histogram.count(), 100u);
+    ASSERT_EQ(histogram.max(), 100000u);
+    ASSERT_DOUBLE_EQ(histogram.mean(), 50500.0);
+    ASSERT_NEAR(double(histogram.percentile(0.5)), 50000.0, 50000.0 / 16);
+    ASSERT_NEAR(double(histogram.percentile(0.99)), 99000.0, 99000.0 / 16);
+}
+
+TEST(TestInstrumented, counts_per_event_type) {
+    auto handler = Serial {
+        Instrumented{"counts_per_event_type", [](int& ctx, auto event) -> decltype(void(ctx += event)) {ctx += event;}},
+        [](int& ctx, Tick){ctx++;},
+    };
+
+    int ctx = 0;
+    for (int i = 0; i < 10; i++) {
+        handler(ctx, 1);
+    }
+    handler(ctx, 'a');
+    handler(ctx, Tick{});
+    ASSERT_EQ(ctx, 10 + 'a' + 1);
+
+    auto all = instrumented_stats();
+    auto* ints = find_stats(all, "counts_per_event_type", typeid(int).name());
+    auto* chars = find_stats(all, "counts_per_event_type", typeid(char).name());
+    ASSERT_NE(ints, nullptr);
+    ASSERT_NE(chars, nullptr);
+    ASSERT_EQ(ints->calls, 10u);
+    ASSERT_EQ(ints->latency.count(), 10u);
+    ASSERT_EQ(chars->calls, 1u);
+    ASSERT_EQ(find_stats(all, "counts_per_event_type", typeid(Tick).name()), nullptr);
+}
+
+TEST(TestInstrumented, sampling_and_threads) {
+    auto handler = Instrumented{"sampling_and_threads", [](int& ctx, int event){}, 4};
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; t++) {
+        threads.emplace_back([handler]() mutable {
+            int ctx = 0;
+            for (int i = 0; i < 100; i++) {
+                handler(ctx, i);
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    auto all = instrumented_stats();
+    auto* stats = find_stats(all, "sampling_and_threads", typeid(int).name());
+    ASSERT_NE(stats, nullptr);
+    ASSERT_EQ(stats->calls, 300u);
+    // Threads can share a shard, so only bounds on the samples.
+    ASSERT_GE(stats->latency.count(), 300u / 4);
+    ASSERT_LE(stats->latency.count(), 3 * (100u / 4));
+}
+
+TEST(TestInstrumented, requests_and_stats_request) {
+    auto handler = First {
+        Instrumented{"lookup", [](int& ctx, const std::string& key) -> std::optional<int> {
+            if (key == "missing") {
+                return std::nullopt;
+            }
+            return int(key.size());
+        }},
+        [](int& ctx, const std::string& key){return -1;},
+        InstrumentedStats{},
+    };
+
+    int ctx = 0;
+    ASSERT_EQ(handler(ctx, std::string("four")), 4);
+    ASSERT_EQ(handler(ctx, std::string("missing")), -1);
+
+    std::vector<HandlerStats> all = handler(ctx, HandlerStatsRequest{});
+    auto* stats = find_stats(all, "lookup", typeid(std::string).name());
+    ASSERT_NE(stats, nullptr);
+    ASSERT_EQ(stats->calls, 2u);
+}
+
+TEST(TestInstrumented, exceptions_are_timed_and_rethrown) {
+    auto handler = Instrumented{"exceptions_are_timed", [](int& ctx, int event){throw std::runtime_error("failed");}};
+
+    int ctx = 0;
+    ASSERT_THROW(handler(ctx, 1), std::runtime_error);
+    auto all = instrumented_stats();
+    auto* stats = find_stats(all, "exceptions_are_timed", typeid(int).name());
+    ASSERT_NE(stats, nullptr);
+    ASSERT_EQ(stats->latency.count(), 1u);
+}
+
+TEST(TestInstrumented, unregistered_when_destroyed) {
+    {
+        auto handler = Instrumented{"unregistered_when_destroyed", [](int& ctx, int event){}};
+        int ctx = 0;
+        handler(ctx, 1);
+        ASSERT_NE(find_stats(instrumented_stats(), "unregistered_when_destroyed", typeid(int).name()), nullptr);
+    }
+    ASSERT_EQ(find_stats(instrumented_stats(), "unregistered_when_destroyed", typeid(int).name()), nullptr);
+}
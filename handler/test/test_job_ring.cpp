@@ -0,0 +1,201 @@
+#include <array>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/job_ring.h"
+
+
+TEST(TestJobRing, runs_in_order) {
+    JobRing<> ring(16);
+    std::vector<int> seen;
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(ring.try_push([&seen, i]{seen.push_back(i);}));
+    }
+    while (ring.try_run_one()) {}
+    ASSERT_EQ(seen, (std::vector<int>{0, 1, 2}));
+    ASSERT_TRUE(ring.empty());
+}
+
+TEST(TestJobRing, full) {
+    JobRing<Producers::Single> ring(8);
+    ASSERT_EQ(ring.capacity_slots(), 8u);
+    int runs = 0;
+    for (std::size_t i = 0; i < ring.capacity_slots(); i++) {
+        ASSERT_TRUE(ring.try_push([&runs]{runs++;}));
+    }
+    ASSERT_FALSE(ring.try_push([&runs]{runs++;}));
+    ASSERT_TRUE(ring.try_run_one());
+    ASSERT_TRUE(ring.try_push([&runs]{runs++;}));
+    while (ring.try_run_one()) {}
+    ASSERT_EQ(runs, 9);
+}
+
+TEST(TestJobRing, wraps_with_padding) {
+    JobRing<Producers::Single> ring(8);
+    std::array<char, 100> big{};
+    int runs = 0;
+    auto two_slots = [&runs, big]{runs += big[0] + 1;};
+    static_assert(JobRing<>::fits_inline<decltype(two_slots)>(), "");
+
+    // Two slot jobs starting at an odd slot force padding at the end of the ring.
+    for (int i = 0; i < 20; i++) {
+        ASSERT_TRUE(ring.try_push([&runs]{runs++;}));
+        ASSERT_TRUE(ring.try_push(two_slots));
+        ASSERT_TRUE(ring.try_run_one());
+        ASSERT_TRUE(ring.try_run_one());
+        ASSERT_TRUE(ring.empty());
+    }
+    ASSERT_EQ(runs, 40);
+}
+
+TEST(TestJobRing, heap_fallback) {
+    JobRing<> ring(8);
+    std::array<char, 1024> huge{};
+    huge[1000] = 7;
+    int seen = 0;
+    auto job = [&seen, huge]{seen = huge[1000];};
+    static_assert(!JobRing<>::fits_inline<decltype(job)>(), "");
+
+    ASSERT_TRUE(ring.try_push(std::move(job)));
+    ASSERT_TRUE(ring.try_run_one());
+    ASSERT_EQ(seen, 7);
+}
+
+TEST(TestJobRing, destroys_unrun_jobs) {
+    auto counter = std::make_shared<int>(0);
+    {
+        JobRing<> ring(8);
+        ASSERT_TRUE(ring.try_push([counter]{}));
+        ASSERT_EQ(counter.use_count(), 2);
+    }
+    ASSERT_EQ(counter.use_count(), 1);
+}
+
+struct ThrowOnMove {
+    ThrowOnMove() = default;
+    ThrowOnMove(ThrowOnMove&&) {throw std::runtime_error("move");}
+    void operator()() {}
+};
+
+TEST(TestJobRing, throwing_job_leaves_ring_usable) {
+    JobRing<> ring(8);
+    ASSERT_THROW(ring.try_push(ThrowOnMove{}), std::runtime_error);
+    ASSERT_TRUE(ring.empty());
+
+    int runs = 0;
+    ASSERT_TRUE(ring.try_push([&runs]{runs++;}));
+    ASSERT_TRUE(ring.try_run_one());
+    ASSERT_EQ(runs, 1);
+}
+
+TEST(TestJobRing, multi_producer) {
+    constexpr int producers = 4;
+    constexpr int per_producer = 10000;
+    JobRing<> ring(64);
+    std::vector<int> next(producers, 0);
+    bool in_order = true;
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p]{
+            for (int i = 0; i < per_producer; i++) {
+                // alternate sizes so records move around the ring
+                auto check = [&next, &in_order, p, i]{
+                    in_order = in_order && next[p] == i;
+                    next[p]++;
+                };
+                std::array<char, 80> pad{};
+                if (i % 2) {
+                    while (!ring.try_push(check)) {
+                        std::this_thread::yield();
+                    }
+                } else {
+                    while (!ring.try_push([check, pad]() mutable {check();})) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        });
+    }
+
+    int received = 0;
+    while (received < producers * per_producer) {
+        if (ring.try_run_one()) {
+            received++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    ASSERT_TRUE(in_order);
+    for (int count: next) {
+        ASSERT_EQ(count, per_producer);
+    }
+}
+
+namespace {
+    struct BatchJob {
+        std::vector<std::size_t>* batch_sizes;
+        void operator()() {batch_sizes->push_back(1);}
+
+        static constexpr bool batchable = true;
+        static void run_batch(BatchJob** jobs, std::size_t count) {
+            jobs[0]->batch_sizes->push_back(count);
+        }
+    };
+}
+
+TEST(TestJobRing, run_batch) {
+    JobRing<> ring(64);
+    std::vector<std::size_t> batch_sizes;
+    int plain = 0;
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(ring.try_push(BatchJob{&batch_sizes}));
+    }
+    ASSERT_TRUE(ring.try_push([&plain]{plain++;}));
+    for (int i = 0; i < 2; i++) {
+        ASSERT_TRUE(ring.try_push(BatchJob{&batch_sizes}));
+    }
+    ASSERT_TRUE(ring.try_push(BatchJob{&batch_sizes}));
+
+    ASSERT_EQ(ring.run_batch(5), 5u);
+    ASSERT_EQ(batch_sizes, (std::vector<std::size_t>{3, 1}));
+    ASSERT_EQ(plain, 1);
+    ASSERT_EQ(ring.run_batch(), 2u);
+    ASSERT_EQ(batch_sizes, (std::vector<std::size_t>{3, 1, 2}));
+    ASSERT_TRUE(ring.empty());
+}
+
+TEST(TestJobRing, run_batch_full_ring) {
+    JobRing<> ring(8);
+    std::vector<int> runs(ring.capacity_slots(), 0);
+    // Moves the ring part way round first so the full ring wraps past the end.
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(ring.try_push([]{}));
+    }
+    ASSERT_EQ(ring.run_batch(), 3u);
+
+    for (auto& run: runs) {
+        ASSERT_TRUE(ring.try_push([&run]{run++;}));
+    }
+    ASSERT_FALSE(ring.try_push([]{}));
+    ASSERT_EQ(ring.run_batch(), ring.capacity_slots());
+    ASSERT_EQ(runs, std::vector<int>(ring.capacity_slots(), 1));
+    ASSERT_TRUE(ring.empty());
+}
+
+TEST(TestJobRing, run_batch_cancel) {
+    JobRing<> ring(64);
+    std::atomic<bool> cancel{false};
+    auto counter = std::make_shared<int>(0);
+    ASSERT_TRUE(ring.try_push([&cancel]{cancel = true;}));
+    ASSERT_TRUE(ring.try_push([counter]{(*counter)++;}));
+    ASSERT_EQ(ring.run_batch(detail::max_job_batch, &cancel), 2u);
+    ASSERT_EQ(*counter, 0);
+    ASSERT_EQ(counter.use_count(), 1);
+    ASSERT_TRUE(ring.empty());
+}
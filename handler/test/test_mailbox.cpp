@@ -0,0 +1,83 @@
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/mailbox.h"
+
+TEST(TestMailbox, runs_posts_on_the_draining_thread) {
+    constexpr int threads = 4;
+    constexpr int posts = 100;
+    Mailbox<> mailbox;
+    std::thread::id main_thread = std::this_thread::get_id();
+    int total = 0;
+    std::atomic<int> off_thread{0};
+
+    std::vector<std::thread> posters;
+    for (int t = 0; t < threads; t++) {
+        posters.emplace_back([&]{
+            for (int i = 0; i < posts; i++) {
+                while (!mailbox.post([&]{
+                    off_thread += std::this_thread::get_id() != main_thread;
+                    total++;
+                })) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    while (total < threads * posts) {
+        mailbox.drain();
+        std::this_thread::yield();
+    }
+    for (auto& poster: posters) {
+        poster.join();
+    }
+    ASSERT_EQ(total, threads * posts);
+    ASSERT_EQ(off_thread, 0);
+    ASSERT_FALSE(mailbox.has_pending());
+}
+
+TEST(TestMailbox, drains_bounded_batches) {
+    Mailbox<> mailbox;
+    int ran = 0;
+    for (int i = 0; i < 100; i++) {
+        ASSERT_TRUE(mailbox.post([&]{ran++;}));
+    }
+    ASSERT_EQ(mailbox.drain(30), 30u);
+    ASSERT_EQ(ran, 30);
+    ASSERT_EQ(mailbox.drain(), 70u);
+    ASSERT_EQ(mailbox.drain(), 0u);
+}
+
+TEST(TestMailbox, call_returns_a_future) {
+    Mailbox<> mailbox;
+    auto future = mailbox.call([]{return 42;});
+    ASSERT_FALSE(future.ready());
+    mailbox.drain();
+    ASSERT_EQ(future.get(), 42);
+
+    auto failing = mailbox.call([]() -> int {throw std::runtime_error("failed");});
+    mailbox.drain();
+    ASSERT_THROW(failing.get(), std::runtime_error);
+}
+
+TEST(TestMailbox, full_and_throwing) {
+    Mailbox<> mailbox(16);
+    int ran = 0;
+    int posted = 0;
+    while (mailbox.post([&]{ran++;})) {
+        posted++;
+    }
+    ASSERT_EQ(mailbox.dropped(), 1u);
+    ASSERT_THROW(mailbox.call([]{return 1;}).get(), QueueFull);
+    mailbox.drain();
+    ASSERT_EQ(ran, posted);
+
+    // A job that throws doesn't stop the ones after it.
+    mailbox.post([]{throw std::runtime_error("failed");});
+    mailbox.post([&]{ran++;});
+    ASSERT_THROW(mailbox.drain(), std::runtime_error);
+    ASSERT_EQ(ran, posted + 1);
+}
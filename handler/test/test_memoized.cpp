@@ -0,0 +1,125 @@
+#include <functional>
+#include <optional>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "event/memoized.h"
+#include "event/first.h"
+#include "event/serial.h"
+
+namespace {
+    struct Lookup {
+        int id;
+
+        bool operator==(const Lookup& other) const {return id == other.id;}
+    };
+
+    struct LookupHash {
+        std::size_t operator()(const Lookup& lookup) const {return std::hash<int>{}(lookup.id);}
+    };
+
+    struct Reload {};
+    struct Tick {};
+}
+
+TEST(TestMemoized, caches_answers) {
+    int calls = 0;
+    auto square = Memoized{[&](int& ctx, int request){
+        calls++;
+        return request * request;
+    }};
+    auto handler = First{square};
+
+    int ctx = 0;
+    ASSERT_EQ(handler(ctx, 3), 9);
+    ASSERT_EQ(handler(ctx, 3), 9);
+    ASSERT_EQ(handler(ctx, 4), 16);
+    ASSERT_EQ(handler(ctx, 3), 9);
+    ASSERT_EQ(calls, 2);
+
+    auto stats = square.stats();
+    ASSERT_EQ(stats.hits, 2u);
+    ASSERT_EQ(stats.misses, 2u);
+    ASSERT_DOUBLE_EQ(stats.hit_rate(), 0.5);
+}
+
+TEST(TestMemoized, keeps_optional_answers) {
+    int calls = 0;
+    int fallbacks = 0;
+    auto handler = First {
+        Memoized{
+            [&](int& ctx, const Lookup& lookup) -> std::optional<std::string> {
+                calls++;
+                if (lookup.id % 2 == 0) {
+                    return "even";
+                }
+                return std::nullopt;
+            },
+            16,
+            LookupHash{},
+        },
+        [&](int& ctx, const Lookup& lookup){
+            fallbacks++;
+            return std::string("odd");
+        },
+    };
+
+    int ctx = 0;
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(handler(ctx, Lookup{2}), "even");
+        ASSERT_EQ(handler(ctx, Lookup{3}), "odd");
+    }
+    // The nullopt for 3 is remembered, the handler after it still answers every time.
+    ASSERT_EQ(calls, 2);
+    ASSERT_EQ(fallbacks, 3);
+}
+
+TEST(TestMemoized, evicts_least_recently_used) {
+    int calls = 0;
+    auto memoized = Memoized{[&](int& ctx, int request){
+        calls++;
+        return request;
+    }, 2};
+
+    int ctx = 0;
+    memoized(ctx, 1);
+    memoized(ctx, 2);
+    memoized(ctx, 1);
+    // 2 is the least recently used now.
+    memoized(ctx, 3);
+    ASSERT_EQ(calls, 3);
+    memoized(ctx, 1);
+    memoized(ctx, 3);
+    ASSERT_EQ(calls, 3);
+    memoized(ctx, 2);
+    ASSERT_EQ(calls, 4);
+    ASSERT_EQ(memoized.stats().evictions, 2u);
+}
+
+TEST(TestMemoized, invalidated_by_events) {
+    int version = 1;
+    auto memoized = Memoized{
+        invalidated_by<Reload>,
+        [&](int& ctx, const Lookup& lookup){return lookup.id * 10 + version;},
+        16,
+        LookupHash{},
+    };
+    auto requests = First{memoized};
+    auto events = Serial {
+        memoized.invalidator(),
+        [](int& ctx, Tick){ctx++;},
+    };
+
+    int ctx = 0;
+    ASSERT_EQ(requests(ctx, Lookup{1}), 11);
+    version = 2;
+    events(ctx, Tick{});
+    ASSERT_EQ(requests(ctx, Lookup{1}), 11);
+    events(ctx, Reload{});
+    ASSERT_EQ(requests(ctx, Lookup{1}), 12);
+
+    auto stats = memoized.stats();
+    ASSERT_EQ(stats.invalidations, 1u);
+    ASSERT_EQ(stats.hits, 1u);
+    ASSERT_EQ(stats.misses, 2u);
+}
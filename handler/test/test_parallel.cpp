@@ -0,0 +1,163 @@
+#include <array>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <optional>
+
+#include "gtest/gtest.h"
+#include "event/parallel.h"
+#include "event/gather.h"
+#include "event/buffered.h"
+
+namespace {
+    // Each handler waits for all of the others, so it only finishes if they run at the same time.
+    struct Rendezvous {
+        std::atomic<int> arrived{0};
+        int expected;
+
+        void arrive() {
+            arrived++;
+            while (arrived < expected) {
+                std::this_thread::yield();
+            }
+        }
+    };
+}
+
+TEST(TestParallel, runs_concurrently) {
+    Executor executor(2);
+    Rendezvous rendezvous{{0}, 3};
+    std::atomic<int> total{0};
+    auto handler = Parallel {
+        executor,
+        [&](int& ctx, const int& event){rendezvous.arrive(); total += event;},
+        [&](int& ctx, const int& event){rendezvous.arrive(); total += 2 * event;},
+        [&](int& ctx, std::string event){total += 100;},
+        [&](int& ctx, const int& event){rendezvous.arrive(); total += 3 * event;},
+    };
+
+    int ctx = 0;
+    handler(ctx, 1);
+    ASSERT_EQ(total, 6);
+    handler(ctx, std::string("only one handler"));
+    ASSERT_EQ(total, 106);
+}
+
+TEST(TestParallel, rethrows_first_exception) {
+    Executor executor(2);
+    std::atomic<int> ran{0};
+    auto handler = Parallel {
+        executor,
+        [&](int& ctx, int event){ran++; throw std::runtime_error("first");},
+        [&](int& ctx, int event){ran++;},
+        [&](int& ctx, int event){ran++; throw std::logic_error("last");},
+    };
+
+    int ctx = 0;
+    ASSERT_THROW(handler(ctx, 1), std::runtime_error);
+    ASSERT_EQ(ran, 3);
+}
+
+TEST(TestParallel, nested_on_executor_thread) {
+    // With one thread the outer Parallel has to help with the inner one's tasks.
+    Executor executor(1);
+    std::atomic<int> total{0};
+    auto inner = Parallel {
+        executor,
+        [&](int& ctx, int event){total += event;},
+        [&](int& ctx, int event){total += event;},
+    };
+    auto outer = Buffered {
+        Parallel {
+            executor,
+            [&](int& ctx, int event){inner(ctx, event);},
+            [&](int& ctx, int event){inner(ctx, event);},
+        },
+        executor,
+    };
+
+    int ctx = 0;
+    Completion<void> done;
+    outer.submit(ctx, 1, done);
+    done.get();
+    ASSERT_EQ(total, 4);
+}
+
+TEST(TestParallel, joining_thread_only_runs_its_own_tasks) {
+    Executor executor(1);
+    std::atomic<bool> open{false};
+    std::atomic<bool> entered{false};
+    auto blocker = Buffered {
+        [&](int& ctx, int event){
+            entered = true;
+            while (!open) {
+                std::this_thread::yield();
+            }
+        },
+        executor,
+    };
+    // A strand queued ahead of the fork, it must wait for the executor's thread.
+    std::atomic<bool> strand_on_caller{false};
+    auto caller = std::this_thread::get_id();
+    auto other = Buffered {
+        [&](int& ctx, int event){strand_on_caller = std::this_thread::get_id() == caller;},
+        executor,
+    };
+    std::atomic<int> total{0};
+    auto handler = Parallel {
+        executor,
+        [&](int& ctx, const int& event){total += event;},
+        [&](int& ctx, const int& event){total += 2 * event;},
+    };
+
+    int ctx = 0;
+    blocker.post(ctx, 0);
+    while (!entered) {
+        std::this_thread::yield();
+    }
+    Completion<void> done;
+    other.submit(ctx, 0, done);
+    // The executor's only thread is busy, so both handlers run here.
+    handler(ctx, 1);
+    ASSERT_EQ(total, 3);
+
+    open = true;
+    done.get();
+    ASSERT_FALSE(strand_on_caller);
+}
+
+TEST(TestGather, tuple_of_results) {
+    Executor executor(2);
+    auto handler = Gather {
+        executor,
+        [](int& ctx, const std::string& request){return request.size();},
+        [](int& ctx, int request){return request;},
+        [](int& ctx, const std::string& request){return request + "!";},
+        [](int& ctx, const std::string& request) -> std::optional<int> {return std::nullopt;},
+    };
+
+    int ctx = 0;
+    auto [size, shout, none] = handler(ctx, std::string("hi"));
+    ASSERT_EQ(size, 2u);
+    ASSERT_EQ(shout, "hi!");
+    ASSERT_FALSE(none);
+}
+
+TEST(TestGather, array_of_results) {
+    Executor executor(2);
+    Rendezvous rendezvous{{0}, 3};
+    auto handler = Gather {
+        executor,
+        [&](int& ctx, int request){rendezvous.arrive(); return request + 1;},
+        [&](int& ctx, int request){rendezvous.arrive(); return request + 2;},
+        [&](int& ctx, int request){rendezvous.arrive(); return request + 3;},
+    };
+
+    int ctx = 0;
+    auto results = handler(ctx, 10);
+    static_assert(std::is_same_v<decltype(results), std::array<int, 3>>, "");
+    ASSERT_EQ(results, (std::array<int, 3>{11, 12, 13}));
+}
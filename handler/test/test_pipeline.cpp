@@ -0,0 +1,151 @@
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/pipeline.h"
+
+namespace {
+    struct Packet {
+        std::string bytes;
+    };
+
+    struct Message {
+        int value;
+    };
+}
+
+TEST(TestPipeline, stages_in_order) {
+    constexpr int kEvents = 500;
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    std::vector<int> seen;
+    auto note_thread = [&]{
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.insert(std::this_thread::get_id());
+    };
+    auto handler = Pipeline {
+        [&](int& ctx, Packet packet){
+            note_thread();
+            return Message{std::stoi(packet.bytes)};
+        },
+        [&](int& ctx, Message message){
+            note_thread();
+            return message.value * 2;
+        },
+        [&](int& ctx, int value){
+            note_thread();
+            std::lock_guard<std::mutex> lock(mutex);
+            seen.push_back(value);
+        },
+    };
+    static_assert(decltype(handler)::accepts_v<int, Packet>);
+    static_assert(!decltype(handler)::accepts_v<int, Message>);
+
+    int ctx = 0;
+    for (int i = 0; i < kEvents; i++) {
+        handler(ctx, Packet{std::to_string(i)});
+    }
+    Completion<void> done;
+    handler.submit(ctx, Packet{std::to_string(kEvents)}, done);
+    done.get();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_EQ(seen.size(), std::size_t(kEvents + 1));
+    for (int i = 0; i <= kEvents; i++) {
+        ASSERT_EQ(seen[i], i * 2);
+    }
+    ASSERT_EQ(threads.size(), 3u);
+    ASSERT_EQ(threads.count(std::this_thread::get_id()), 0u);
+}
+
+TEST(TestPipeline, results_and_errors) {
+    auto handler = Pipeline {
+        [](int& ctx, int value){
+            if (value < 0) {
+                throw std::invalid_argument("negative");
+            }
+            return value + 1;
+        },
+        [](int& ctx, int value){return std::to_string(value);},
+    };
+
+    int ctx = 0;
+    ASSERT_EQ(handler.async(ctx, 41).get(), "42");
+    auto failed = handler.async(ctx, -1);
+    ASSERT_THROW(failed.get(), std::invalid_argument);
+    Completion<std::string> done;
+    handler.submit(ctx, 1, done);
+    ASSERT_EQ(done.get(), "2");
+
+    auto first = handler.stats(0);
+    ASSERT_EQ(first.handled, 2u);
+    ASSERT_EQ(first.failed, 1u);
+    ASSERT_EQ(handler.stats(1).handled, 2u);
+    ASSERT_EQ(handler.stats(1).failed, 0u);
+}
+
+TEST(TestPipeline, occupancy_finds_bottleneck) {
+    constexpr int kEvents = 40;
+    // Options for the first stage only, the others get the defaults.
+    WorkerOptions spin;
+    spin.wait = WaitStrategy::SpinPark;
+    spin.spins = 64;
+    auto handler = Pipeline {
+        std::vector<WorkerOptions>{spin},
+        [](int& ctx, int value){return value;},
+        [](int& ctx, int value){
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+            return value;
+        },
+        [](int& ctx, int value){},
+    };
+
+    int ctx = 0;
+    for (int i = 0; i < kEvents; i++) {
+        handler(ctx, i);
+    }
+    Completion<void> done;
+    handler.submit(ctx, kEvents, done);
+    done.get();
+
+    auto slow = handler.stats(1);
+    ASSERT_EQ(slow.handled, std::uint64_t(kEvents + 1));
+    ASSERT_EQ(slow.queued, 0u);
+    ASSERT_GE(slow.busy, std::chrono::microseconds(500 * kEvents));
+    ASSERT_GT(slow.occupancy, handler.stats(0).occupancy);
+    ASSERT_GT(slow.occupancy, handler.stats(2).occupancy);
+    ASSERT_LE(slow.occupancy, 1.0);
+}
+
+TEST(TestPipeline, waiting_for_a_slow_stage_is_not_busy) {
+    // More than the rings between the stages hold, so the first two back up behind the last.
+    constexpr int kEvents = 3 * 1024;
+    auto handler = Pipeline {
+        [](int& ctx, int value){return value;},
+        [](int& ctx, int value){return value;},
+        [](int& ctx, int value){
+            if (value == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            }
+        },
+    };
+
+    int ctx = 0;
+    for (int i = 0; i < kEvents; i++) {
+        handler(ctx, i);
+    }
+    Completion<void> done;
+    handler.submit(ctx, kEvents, done);
+    done.get();
+
+    auto last = handler.stats(2);
+    ASSERT_EQ(last.handled, std::uint64_t(kEvents + 1));
+    ASSERT_GT(last.occupancy, 0.5);
+    ASSERT_LT(handler.stats(0).occupancy, 0.2);
+    ASSERT_LT(handler.stats(1).occupancy, 0.2);
+}
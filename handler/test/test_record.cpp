@@ -0,0 +1,150 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/record.h"
+#include "event/first.h"
+#include "event/serial.h"
+
+namespace {
+    struct Key {
+        char c;
+    };
+
+    struct Resize {
+        int width;
+        int height;
+    };
+
+    struct Lookup {
+        int id;
+    };
+
+    // Just enough of a Ctx to replay into.
+    struct ReplayCtx {
+        std::string log;
+
+        void handle_event(Key key) {log += key.c;}
+        void handle_event(Resize resize) {log += "[" + std::to_string(resize.width) + "x" + std::to_string(resize.height) + "]";}
+        int handle_request(Lookup lookup) {
+            log += "?" + std::to_string(lookup.id);
+            return lookup.id;
+        }
+    };
+
+    std::string log_path(const char* name) {
+        return testing::TempDir() + name;
+    }
+}
+
+TEST(TestRecord, record_and_replay) {
+    std::string path = log_path("record_and_replay.evlog");
+    {
+        EventRecorder<Events<Key, Resize>, Requests<Lookup>> recorder(path);
+        auto events = Serial {
+            recorder.events(),
+            [](int& ctx, const Key& key){ctx++;},
+            [](int& ctx, const Resize& resize){ctx++;},
+            // Not registered, so not recorded.
+            [](int& ctx, const std::string& s){ctx++;},
+        };
+        auto requests = First {
+            recorder.requests(),
+            [](int& ctx, const Lookup& lookup){return lookup.id * 2;},
+        };
+
+        int ctx = 0;
+        events(ctx, Key{'a'});
+        events(ctx, Resize{640, 480});
+        events(ctx, std::string("skipped"));
+        ASSERT_EQ(requests(ctx, Lookup{7}), 14);
+        events(ctx, Key{'b'});
+        ASSERT_EQ(ctx, 4);
+    }
+
+    EventReplayer<Events<Key, Resize>, Requests<Lookup>> replayer(path);
+    ReplayCtx ctx;
+    ASSERT_EQ(replayer.replay(ctx), 4u);
+    ASSERT_EQ(ctx.log, "a[640x480]?7b");
+    std::remove(path.c_str());
+}
+
+TEST(TestRecord, original_timing) {
+    std::string path = log_path("original_timing.evlog");
+    {
+        EventRecorder<Events<Key>> recorder(path);
+        recorder.record(Key{'a'});
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        recorder.record(Key{'b'});
+    }
+
+    EventReplayer<Events<Key>> replayer(path);
+    ReplayCtx ctx;
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(replayer.replay(ctx, ReplayTiming::Original), 2u);
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(25));
+    ASSERT_EQ(ctx.log, "ab");
+    std::remove(path.c_str());
+}
+
+TEST(TestRecord, many_records_and_truncated_log) {
+    std::string path = log_path("many_records.evlog");
+    constexpr int kRecords = 10000;
+    {
+        EventRecorder<Events<Resize>> recorder(path);
+        for (int i = 0; i < kRecords; i++) {
+            recorder.record(Resize{i, i});
+        }
+        recorder.flush();
+    }
+
+    struct CountCtx {
+        int count = 0;
+        bool ordered = true;
+        void handle_event(Resize resize) {
+            ordered = ordered && resize.width == count;
+            count++;
+        }
+    };
+    {
+        EventReplayer<Events<Resize>> replayer(path);
+        CountCtx ctx;
+        ASSERT_EQ(replayer.replay(ctx), std::size_t(kRecords));
+        ASSERT_TRUE(ctx.ordered);
+    }
+
+    // As if recording stopped half way through writing the last record.
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    auto size = static_cast<std::size_t>(in.tellg());
+    in.close();
+    ASSERT_EQ(::truncate(path.c_str(), static_cast<off_t>(size - 3)), 0);
+    EventReplayer<Events<Resize>> replayer(path);
+    CountCtx ctx;
+    ASSERT_EQ(replayer.replay(ctx), std::size_t(kRecords - 1));
+    std::remove(path.c_str());
+}
+
+TEST(TestRecord, rejects_other_logs) {
+    std::string path = log_path("rejects_other_logs.evlog");
+    {
+        EventRecorder<Events<Key, Resize>> recorder(path);
+    }
+    ASSERT_THROW((EventReplayer<Events<Resize, Key>>(path)), std::runtime_error);
+    ASSERT_THROW((EventReplayer<Events<Key>>(path)), std::runtime_error);
+    ASSERT_THROW((EventReplayer<Events<Key>, Requests<Resize>>(path)), std::runtime_error);
+    ASSERT_NO_THROW((EventReplayer<Events<Key, Resize>>(path)));
+
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << "definitely not an event log";
+    }
+    ASSERT_THROW((EventReplayer<Events<Key, Resize>>(path)), std::runtime_error);
+    ASSERT_THROW((EventReplayer<Events<Key>>(log_path("does_not_exist.evlog"))), std::runtime_error);
+    std::remove(path.c_str());
+}
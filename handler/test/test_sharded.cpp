@@ -0,0 +1,117 @@
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event/sharded.h"
+
+namespace {
+    struct Move {
+        int entity;
+        int seq;
+    };
+
+    auto by_entity = [](const Move& event){return event.entity;};
+}
+
+TEST(TestSharded, per_key_order) {
+    constexpr int kEntities = 16;
+    constexpr int kMoves = 200;
+    std::mutex mutex;
+    std::unordered_map<int, std::vector<int>> seen;
+    std::set<std::thread::id> threads;
+    auto handler = Sharded {
+        shards<4>,
+        by_entity,
+        [&](int& ctx, Move event){
+            std::lock_guard<std::mutex> lock(mutex);
+            seen[event.entity].push_back(event.seq);
+            threads.insert(std::this_thread::get_id());
+        },
+    };
+
+    int ctx = 0;
+    for (int seq = 0; seq < kMoves; seq++) {
+        for (int entity = 0; entity < kEntities; entity++) {
+            handler(ctx, Move{entity, seq});
+        }
+    }
+    // The last event of each entity is queued behind all the others.
+    std::vector<Completion<void>> done(kEntities);
+    for (int entity = 0; entity < kEntities; entity++) {
+        handler.submit(ctx, Move{entity, kMoves}, done[entity]);
+    }
+    for (auto& d: done) {
+        d.get();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_EQ(seen.size(), std::size_t(kEntities));
+    for (auto& [entity, seqs]: seen) {
+        ASSERT_EQ(seqs.size(), std::size_t(kMoves + 1));
+        for (int i = 0; i <= kMoves; i++) {
+            ASSERT_EQ(seqs[i], i);
+        }
+    }
+    ASSERT_GT(threads.size(), 1u);
+    ASSERT_LE(threads.size(), 4u);
+}
+
+TEST(TestSharded, keys_spread_over_shards) {
+    auto ignore = [](int& ctx, Move event){};
+    using ShardedT = Sharded<4, decltype(by_entity), decltype(ignore)>;
+    std::vector<int> counts(4);
+    // Multiples of the shard count are the bad case for a plain modulo.
+    for (int key = 0; key < 4000; key += 4) {
+        counts[ShardedT::shard_index(key)]++;
+    }
+    for (int count: counts) {
+        ASSERT_GT(count, 150);
+    }
+}
+
+TEST(TestSharded, results_and_errors) {
+    auto handler = Sharded {
+        shards<3>,
+        [](const std::string& event){return event;},
+        [](int& ctx, std::string event){
+            if (event.empty()) {
+                throw std::runtime_error("empty");
+            }
+            return event.size();
+        },
+    };
+
+    int ctx = 0;
+    auto future = handler(ctx, std::string("hello"));
+    ASSERT_EQ(future.get(), 5u);
+    ASSERT_EQ(handler.async(ctx, std::string("hi")).get(), 2u);
+    ASSERT_THROW(handler(ctx, std::string()).get(), std::runtime_error);
+}
+
+TEST(TestSharded, on_executor) {
+    Executor executor(2);
+    std::atomic<int> total{0};
+    auto handler = Sharded {
+        shards<4>,
+        by_entity,
+        [&](int& ctx, Move event){total += event.seq;},
+        executor,
+    };
+
+    int ctx = 0;
+    std::vector<Completion<void>> done(8);
+    for (int entity = 0; entity < 8; entity++) {
+        handler.post(ctx, Move{entity, 1});
+        handler.submit(ctx, Move{entity, 0}, done[entity]);
+    }
+    for (auto& d: done) {
+        d.get();
+    }
+    ASSERT_EQ(total, 8);
+}
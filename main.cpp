@@ -12,7 +12,10 @@
 #include "event/serial.h"
 #include "event/first.h"
 #include "event/buffered.h"
+#include "event/broadcast.h"
 #include "event/must_handle.h"
+#include "event/mailbox.h"
+#include "event/frame_arena.h"
 #include "vulkan_utils/instance.h"
 #include "vulkan_utils/device.h"
 #include "vulkan_utils/swapchain.h"
@@ -149,6 +152,15 @@ private:
     std::unique_ptr<SDL_Window, WindowDelete> window;
 };
 
+// handle_event and handle_request run the handlers on the calling thread, which must be
+// the main thread. Other threads, e.g. Buffered workers, post_event and post_request
+// instead, those are queued and handled on the main thread when the main loop calls
+// drain_ingress once a frame, so handlers can touch main thread only state like the
+// Vulkan device without locks.
+//
+// Event payloads that only need to last the frame, e.g. strings, can be allocated from
+// frame_arena instead of the heap, the main loop frees them all with end_frame. Handlers
+// on other threads copy_out what they keep, see FrameRef.
 template<typename EventHandlerT, typename RequestHandlerT>
 class Ctx {
 public:
@@ -165,7 +177,39 @@ public:
     auto handle_request(RequestT&& t) {
         return request_handler(*this, std::forward<RequestT>(t));
     }
+
+    // Safe from any thread. Returns false if the ingress queue was full and the event dropped.
+    template<class EventT>
+    bool post_event(EventT&& t) {
+        return ingress.post([this, event = std::decay_t<EventT>(std::forward<EventT>(t))]() mutable {
+            handle_event(std::move(event));
+        });
+    }
+
+    // Safe from any thread. Returns a Future for the answer, which fails with QueueFull
+    // if the ingress queue was full.
+    template<class RequestT>
+    auto post_request(RequestT&& t) {
+        return ingress.call([this, request = std::decay_t<RequestT>(std::forward<RequestT>(t))]() mutable {
+            return handle_request(std::move(request));
+        });
+    }
+
+    // Main thread only. Handles up to max_posts of what was posted, oldest first.
+    std::size_t drain_ingress(std::size_t max_posts = 256) {
+        return ingress.drain(max_posts);
+    }
+
+    // Main thread only.
+    FrameArena& frame_arena() {return arena;}
+
+    // Main thread only. Frees everything allocated from frame_arena this frame.
+    void end_frame() {arena.end_frame();}
 private:
+    // First so it outlives the handlers, Buffered workers may still post while they stop.
+    Mailbox<> ingress;
+    // Before the handlers too, their workers may still copy out of it.
+    FrameArena arena;
     EventHandlerT event_handler;
     MustHandle<RequestHandlerT> request_handler;
 };
@@ -179,6 +223,17 @@ struct MyEvent {
     MyEvent& operator=(MyEvent&&) = default;
 };
 
+// Posted by a Buffered worker back to the main thread.
+struct FromWorker {
+    const char* message;
+};
+
+// A frame arena string copied out on the main thread, for handlers that may only get to
+// it after the frame ended.
+struct FrameText {
+    std::string text;
+};
+
 struct MyRequest {
     MyRequest(const MyRequest&) = delete;
     MyRequest& operator=(const MyRequest&) = delete;
@@ -1051,6 +1106,14 @@ int inner_main() {
                 [](auto& ctx, int i){std::cout << ctx.handle_request(i).value() << std::endl;},
                 [](auto& ctx, const char* i){std::cout << "c string " << i << std::endl;},
                 [](auto& ctx, std::string i){std::cout << "c++ string " << i << std::endl;},
+                [](auto& ctx, FromWorker e){std::cout << "On the main thread: " << e.message << std::endl;},
+                // Handled during the frame it was allocated in, so it can be read in place.
+                // Handlers on other threads may only run after the frame ended, they are
+                // handed a copy made now instead.
+                [](auto& ctx, const FrameString& s){
+                    std::cout << "frame string " << s.view() << std::endl;
+                    ctx.handle_event(FrameText{std::string(s.view())});
+                },
 
                 // Because this handler only wants a const MyEvent& and it happens before
                 // the owning handler this will compile.
@@ -1062,22 +1125,30 @@ int inner_main() {
                 // Compiler error because MyEvent can't be copied but 2 handlers want to take by value
                 // [](auto& ctx, MyEvent e){std::cout << "MyEvent is already taken" << std::endl;},
 
-                Buffered {
-                    Serial {
-                        // [](auto& ctx, const MyEvent& e){std::cout << "Buffered can't move from MyEvent because it has already been moved from" << std::endl;},
-                        // Also a compiler error, even though this handler doesn't want ownership of MyEvent
-                        // it is inside a Buffered wrapper and Buffered always needs ownership to
-                        // make sure the event stays alive long enough. Also a compiler error because the owning
-                        // handler for MyEvent comes before this handler, so the MyEvent object
-                        // will already have been moved out of.
-
-                        // Buffered will have made a copy of the string event and move it into the Serial.
-                        // Because this is the last handler in the Serial that string will be moved into this handler.
-                        [](auto& ctx, std::string i){std::cout << "A c++ string " << i << std::endl;},
-                    }
-                },
-                Buffered {
-                    [](auto& ctx, std::string i){std::cout << "B c++ string " << i << std::endl;},
+                // A and B each get a thread of their own but share one copy of the string,
+                // where a Buffered each would both have queued a copy of it.
+                Broadcast {
+                    // [](auto& ctx, const MyEvent& e){std::cout << "Broadcast can't move from MyEvent because it has already been moved from" << std::endl;},
+                    // Also a compiler error, even though this consumer doesn't want ownership of MyEvent
+                    // it is inside a Broadcast wrapper and Broadcast always needs ownership to
+                    // make sure the event stays alive until every consumer is done with it. Also a
+                    // compiler error because the owning handler for MyEvent comes before this handler,
+                    // so the MyEvent object will already have been moved out of.
+
+                    // Broadcast will have moved the string event into its ring, both consumers
+                    // read that one string in place.
+                    [](auto& ctx, const std::string& i){std::cout << "A c++ string " << i << std::endl;},
+                    [](auto& ctx, const std::string& i){
+                        std::cout << "B c++ string " << i << std::endl;
+                        // This runs on B's thread, anything it wants done on the main
+                        // thread goes through the ingress queue.
+                        ctx.post_event(FromWorker{"B is done"});
+                    },
+                    // Consumers skip the events they don't take, C only sees the copies of
+                    // frame strings.
+                    [](auto& ctx, const FrameText& s){
+                        std::cout << "C frame string " << s.text << std::endl;
+                    },
                 },
             }},
         },
@@ -1121,6 +1192,7 @@ int inner_main() {
 
     ctx.handle_event(MyEvent{});
     ctx.handle_event(std::string("hello"));
+    ctx.handle_event(ctx.frame_arena().copy("hello from the frame arena"));
     ctx.handle_event(2);
 
     const int width = 1800;
@@ -1141,6 +1213,7 @@ int inner_main() {
     bool resized = false;
     bool minimised = false;
     while (true) {
+        ctx.drain_ingress();
         while (SDL_PollEvent( &event ) != 0) {
             if( event.type == SDL_QUIT ) {
                 vulkan_state.device->waitIdle();
@@ -1174,6 +1247,7 @@ int inner_main() {
             resized = false;
             in_flight_index = (in_flight_index + 1)%2;
         }
+        ctx.end_frame();
     }
     return 0;
 }